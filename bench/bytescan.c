@@ -0,0 +1,111 @@
+/*    bytescan.c
+ *
+ * Copyright 2017 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* Microbenchmark of the byte scanning kernels in str.c, which are
+ * static, so str.c is included here rather than linked.
+ * Usage: bench_bytescan [MB [rounds]]
+ * Each kernel the CPU supports runs rounds times (default 10) over MB
+ * megabytes (default 64) of path list text, a '\n' about every 40
+ * bytes, and its GB/s is reported along with the kernel that
+ * str_selectkernels() chose. Every result is checked against the
+ * scalar kernel's.
+ * */
+
+#include <time.h>
+#include "../str.c"
+
+typedef struct kernel {
+	const char *name;
+	size_t (*count)(const char *, size_t, char);
+	size_t (*swap)(char *, size_t, char, char);
+	int ok;	// the CPU has what it needs.
+} kernel;
+
+static double
+now(void)
+{ /* Monotonic seconds. */
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+} // now()
+
+int
+main(int argc, char **argv)
+{
+	size_t mb = (argc > 1) ? strtoul(argv[1], NULL, 10) : 64;
+	int rounds = (argc > 2) ? atoi(argv[2]) : 10;
+	if (!mb || rounds < 1) {
+		fputs("Usage: bench_bytescan [MB [rounds]]\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	size_t n = mb << 20;
+	char *buf = xmalloc(n);
+	size_t i;
+	srand(1);
+	for (i = 0; i < n; i++) buf[i] = (rand() % 40) ? 'a' + rand() % 26 : '\n';
+	kernel ks[] = {
+		{ "scalar", countbyte_scalar, swapbyte_scalar, 1 },
+#ifdef STR_X86
+		{ "sse2", countbyte_sse2, swapbyte_sse2,
+			__builtin_cpu_supports("sse2") },
+		{ "avx2", countbyte_avx2, swapbyte_avx2,
+			__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") },
+#endif
+	};
+	size_t nk = sizeof(ks) / sizeof(kernel);
+	const char *chosen = "scalar";
+	for (i = 0; i < nk; i++) if (ks[i].count == countbyte) chosen = ks[i].name;
+	printf("%zu MB x %d rounds, str_selectkernels() chose %s\n", mb, rounds,
+			chosen);
+	size_t want = countbyte_scalar(buf, n, '\n');
+	for (i = 0; i < nk; i++) {
+		if (!ks[i].ok) {
+			printf("%-7s not supported by this CPU\n", ks[i].name);
+			continue;
+		}
+		int r;
+		double t0 = now();
+		for (r = 0; r < rounds; r++) {
+			if (ks[i].count(buf, n, '\n') != want) {
+				fprintf(stderr, "%s: wrong count.\n", ks[i].name);
+				exit(EXIT_FAILURE);
+			}
+		}
+		double tc = now() - t0;
+		t0 = now();
+		for (r = 0; r < rounds; r++) {	// there and back, as memlinestostr().
+			size_t a = ks[i].swap(buf, n, '\n', 0);
+			size_t b = ks[i].swap(buf, n, 0, '\n');
+			if (a != want || b != want) {
+				fprintf(stderr, "%s: wrong swap count.\n", ks[i].name);
+				exit(EXIT_FAILURE);
+			}
+		}
+		double ts = now() - t0;
+		if (countbyte_scalar(buf, n, '\n') != want) {
+			fprintf(stderr, "%s: swap changed the data.\n", ks[i].name);
+			exit(EXIT_FAILURE);
+		}
+		printf("%-7s countbyte %6.2f GB/s   swapbyte %6.2f GB/s\n", ks[i].name,
+				(double)n * rounds / tc / 1e9, 2.0 * n * rounds / ts / 1e9);
+	}
+	free(buf);
+	return 0;
+} // main()
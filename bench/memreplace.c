@@ -0,0 +1,106 @@
+/*    memreplace.c
+ *
+ * Copyright 2017 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* Benchmark of memreplace() against the memmove() per match version it
+ * replaced, on text with a tab every 4 bytes as fmtoutput() sees.
+ * Usage: bench_memreplace [MB [oldMB]]
+ * memreplace() is timed on 1, 10 and MB megabytes (default 100), the
+ * old quadratic version only up to oldMB (default 2) as it takes
+ * minutes beyond that. Linear time shows as a steady MB/s.
+ * */
+
+#include <time.h>
+#include "../str.h"
+
+static double
+now(void)
+{ /* Monotonic seconds. */
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+} // now()
+
+static mdata
+*maketext(size_t size)
+{ /* size bytes of "abc\t" repeated. */
+	mdata *md = init_mdata();
+	mdata_reserve(md, size + 1);
+	size_t i;
+	for (i = 0; i < size; i++) md->to[i] = (i % 4 == 3) ? '\t' : 'a' + i % 4;
+	md->to += size;
+	*md->to = 0;
+	return md;
+} // maketext()
+
+static void
+oldreplace(mdata *md, char *find, char *repl, off_t meminc)
+{ /* memreplace() as it was, moving the whole tail for each match. */
+	size_t flen = strlen(find);
+	size_t rlen = strlen(repl);
+	off_t ldiff = rlen - flen;
+	const off_t fudge_fence = 8;
+	char *fp = memmem(md->fro, md->to - md->fro, find, flen);
+	while (fp) {
+		off_t avail = md->limit - md->to;
+		if (ldiff + fudge_fence > avail) {
+			off_t fpoffset = fp - md->fro;
+			off_t actualinc = (meminc > ldiff) ? meminc : ldiff + fudge_fence;
+			memresize(md, actualinc);
+			fp = md->fro + fpoffset;
+		}
+		memmove(fp + rlen, fp + flen, md->to - fp);
+		memcpy(fp, repl, rlen);
+		md->to += ldiff;
+		fp = memmem(fp + rlen, md->to - fp - rlen, find, flen);
+	}
+} // oldreplace()
+
+static void
+run(const char *name, size_t mb,
+		void (*fn)(mdata *, char *, char *, off_t))
+{ /* Time fn replacing each tab by 4 spaces in mb megabytes. */
+	size_t size = mb << 20;
+	mdata *md = maketext(size);
+	double t0 = now();
+	fn(md, "\t", "    ", 4096);
+	double t = now() - t0;
+	printf("%-12s %5zu MB  %9zu matches  %9.1f ms  %8.1f MB/s\n", name, mb,
+			size / 4, t * 1e3, mb / t);
+	if ((size_t)(md->to - md->fro) != size / 4 * 7) {
+		fprintf(stderr, "%s: wrong output length.\n", name);
+		exit(EXIT_FAILURE);
+	}
+	free_mdata(md);
+} // run()
+
+int
+main(int argc, char **argv)
+{
+	size_t mb = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100;
+	size_t oldmb = (argc > 2) ? strtoul(argv[2], NULL, 10) : 2;
+	size_t sizes[] = { 1, 10, mb };
+	size_t i;
+	for (i = 0; i < 3; i++) {
+		if (i && sizes[i] <= sizes[i - 1]) break;
+		run("memreplace", sizes[i], memreplace);
+	}
+	for (i = 1; i <= oldmb; i *= 2) run("old", i, oldreplace);
+	return 0;
+} // main()
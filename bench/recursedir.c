@@ -0,0 +1,175 @@
+/*    recursedir.c
+ *
+ * Copyright 2017 Robert L (Bob) Parker rlp1938@gmail.com
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301, USA.
+*/
+
+/* Benchmark of recursedir_par() against recursedir().
+ * Usage: bench_recursedir dir [nthreads ...]
+ * If dir does not exist a synthetic tree of 1M files is made there,
+ * 100 dirs of 100 dirs of 100 files. Each walk is run 3 times and the
+ * best time reported, for the serial walker and then the parallel one
+ * with each nthreads given (default 1 2 4 8), merging its per thread
+ * blocks unsorted. The output of every parallel walk is then sorted
+ * and checked against the serial walker's, outside the timing. The CPU
+ * time of the process during the best walk is shown too, where idle
+ * threads that burn CPU would show.
+ * */
+
+#include <time.h>
+#include <sys/resource.h>
+#include "../dirs.h"
+
+static double
+now(void)
+{ /* Monotonic seconds. */
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+} // now()
+
+static double
+cpu(void)
+{ /* CPU seconds used by the process so far. */
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec
+			+ (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+} // cpu()
+
+static void
+maketree(const char *dir)
+{ /* The synthetic tree of 1M files under dir. */
+	char path[PATH_MAX];
+	newdir(dir, 0);
+	int i, j, k;
+	for (i = 0; i < 100; i++) {
+		sprintf(path, "%s/a%d", dir, i);
+		newdir(path, 0);
+		for (j = 0; j < 100; j++) {
+			sprintf(path, "%s/a%d/b%d", dir, i, j);
+			newdir(path, 0);
+			size_t len = strlen(path);
+			for (k = 0; k < 100; k++) {
+				sprintf(path + len, "/file%04d.c", k);
+				int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+				if (fd == -1) {
+					perror(path);
+					exit(EXIT_FAILURE);
+				}
+				close(fd);
+			}
+		}
+	}
+} // maketree()
+
+static int
+cmp(const void *a, const void *b)
+{ /* qsort() comparison of two paths. */
+	return strcmp(*(char * const *)a, *(char * const *)b);
+} // cmp()
+
+static mdata
+*sorted(mdata *md, int n)
+{ /* The n records of md sorted, as recursedir_par() sorts them. */
+	char **list = xmalloc(n * sizeof(char *));
+	char *cp;
+	int i = 0;
+	for (cp = md->fro; cp < md->to; cp += strlen(cp) + 1) list[i++] = cp;
+	qsort(list, n, sizeof(char *), cmp);
+	mdata *out = init_mdata();
+	mdata_reserve(out, md->to - md->fro);
+	for (i = 0; i < n; i++) {
+		size_t len = strlen(list[i]) + 1;
+		memcpy(out->to, list[i], len);
+		out->to += len;
+	}
+	free(list);
+	return out;
+} // sorted()
+
+static double
+walk(char *dir, int nthreads, mdata **res, int *recs, double *cpus)
+{ /* Best of 3 walks of dir, serial if nthreads is -1, with the CPU time
+   * it took in cpus. The last result is left in res.
+  */
+	double best = 0;
+	int run;
+	for (run = 0; run < 3; run++) {
+		rd_data *rd = init_recursedir(NULL, 1 << 20, DT_REG, DT_DIR, 0);
+		mdata *md = init_mdata();
+		double c0 = cpu();
+		double t0 = now();
+		*recs = (nthreads < 0) ? recursedir(dir, md, rd)
+								: recursedir_par(dir, md, rd, nthreads, 0);
+		double t = now() - t0;
+		if (!run || t < best) {
+			best = t;
+			*cpus = cpu() - c0;
+		}
+		if (run < 2) free_mdata(md);
+		else *res = md;
+		free_recursedir(rd, NULL);
+	}
+	return best;
+} // walk()
+
+int
+main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fputs("Usage: bench_recursedir dir [nthreads ...]\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	char *dir = argv[1];
+	if (!exists_dir(dir)) {
+		double t0 = now();
+		maketree(dir);
+		printf("made 1M file tree in %s, %.1f s\n", dir, now() - t0);
+	}
+	char *dflt[] = { "1", "2", "4", "8" };
+	char **nts = (argc > 2) ? argv + 2 : dflt;
+	int nnt = (argc > 2) ? argc - 2 : 4;
+	printf("%ld CPUs online\n", sysconf(_SC_NPROCESSORS_ONLN));
+	mdata *md;
+	int recs;
+	double cs;
+	double ts = walk(dir, -1, &md, &recs, &cs);
+	mdata *want = sorted(md, recs);
+	free_mdata(md);
+	printf("recursedir()          %8d records  %7.1f ms  cpu %7.1f ms\n",
+			recs, ts * 1e3, cs * 1e3);
+	int i;
+	for (i = 0; i < nnt; i++) {
+		int nt = atoi(nts[i]);
+		int got;
+		double c;
+		double t = walk(dir, nt, &md, &got, &c);
+		mdata *have = sorted(md, got);
+		if (got != recs || have->to - have->fro != want->to - want->fro
+				|| memcmp(have->fro, want->fro, have->to - have->fro) != 0) {
+			fprintf(stderr, "%d threads: output differs.\n", nt);
+			exit(EXIT_FAILURE);
+		}
+		free_mdata(have);
+		free_mdata(md);
+		printf("recursedir_par(), %2d  %8d records  %7.1f ms  cpu %7.1f ms"
+				"  x%.2f\n", nt, got, t * 1e3, c * 1e3, ts / t);
+	}
+	free_mdata(want);
+	return 0;
+} // main()
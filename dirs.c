@@ -25,6 +25,8 @@
 
 #include "dirs.h"
 
+static void rdsync(rd_data *rd);
+
 DIR
 *dopendir(const char *name)
 { /* open a dir with error handling */
@@ -36,46 +38,959 @@ DIR
 	return dir;
 } // dopendir()
 
+typedef struct rdframe {	/* a dir open in the walk of recursedir(). */
+	int fd;
+	char *buf;	// RD_BUFSIZE bytes of getdents64() records.
+	size_t pos;	// next record in buf.
+	size_t len;	// end of the records in buf.
+	size_t plen;	// length of the dir's path.
+} rdframe;
+
+static int
+rdopen(int dirfd, const char *name, const char *path)
+{ /* openat() a dir for reading, failure is fatal. */
+	int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+} // rdopen()
+
+static unsigned char
+rdtype(int dirfd, const char *name)
+{ /* The d_type of name in the dir open at dirfd, for file systems whose
+   * getdents64() gives DT_UNKNOWN. Only the type is asked of statx().
+   * Stays DT_UNKNOWN if name has gone.
+  */
+	fsinfo fi;
+	if (fs_statat(dirfd, name, FS_NOFOLLOW, STATX_TYPE, &fi) == -1)
+		return DT_UNKNOWN;
+	return IFTODT(fi.mode);
+} // rdtype()
+
+static int
+rdinocmp(const void *a, const void *b)
+{ /* qsort() comparison of two dirents by inode. */
+	ino64_t x = (*(struct dirent64 * const *)a)->d_ino;
+	ino64_t y = (*(struct dirent64 * const *)b)->d_ino;
+	return (x > y) - (x < y);
+} // rdinocmp()
+
+static struct dirent64
+**rdtypelist(rd_data *rd)
+{ /* Scratch for rdtypes(), one per walker, or NULL if rd does not ask
+   * for RD_TYPEBATCH. It has room for every record of a full buffer.
+  */
+	if (!rd || !(rd->flags & RD_TYPEBATCH)) return NULL;
+	return xmalloc(RD_BUFSIZE / offsetof(struct dirent64, d_name)
+					* sizeof(struct dirent64 *));
+} // rdtypelist()
+
+static void
+rdtypes(int dirfd, char *buf, size_t len, struct dirent64 **list)
+{ /* Resolve the DT_UNKNOWN entries of a getdents64() buffer in place,
+   * for RD_TYPEBATCH, using list from rdtypelist(). They are looked up
+   * in inode order, which on most disk file systems is the order of the
+   * inode table, so a cold cache reads it forwards instead of seeking
+   * about for each name.
+  */
+	size_t n = 0, pos = 0;
+	while (pos < len) {
+		struct dirent64 *de = (struct dirent64 *)(buf + pos);
+		pos += de->d_reclen;
+		if (de->d_type == DT_UNKNOWN) list[n++] = de;
+	}
+	if (n > 1) qsort(list, n, sizeof(struct dirent64 *), rdinocmp);
+	size_t i;
+	for (i = 0; i < n; i++) list[i]->d_type = rdtype(dirfd, list[i]->d_name);
+} // rdtypes()
+
 int
-recursedir(char *dirname, mdata *ddat, rd_data *rd)
-{ /* Returns count of records recorded.
-	* Caller must init_recursedir() before calling this.
+rd_walk(const char *dirname, rd_data *rd, rd_visitor fn, void *arg)
+{ /* Walk the tree below dirname calling fn for each entry as it is read,
+	* parents before their contents. If rd is not NULL, dirs in its
+	* rejectlist are skipped and fn is only called for entries whose
+	* d_type is in its fsobj. Other dirs are still descended. fn gets
+	* the entry and arg, and returns RD_CONTINUE, RD_PRUNE to not
+	* descend into the dir it was given, or RD_STOP to end the walk.
+	* Returns the number of entries given to fn.
+	* The walk is iterative. Each dir below dirname is opened relative
+	* to its parent's fd and read with getdents64() into a large
+	* buffer. An explicit stack holds one frame per level, whose buffers
+	* are reused from one subtree to the next, so memory use follows
+	* the depth of the tree and not its size. Paths are built in a
+	* single growable buffer, so they are not limited to PATH_MAX.
 	*/
-	DIR *dp = dopendir(dirname);
-	static int recs = 0;
-	struct dirent *de;
-	while ((de = readdir(dp))) {
+	int count = 0;
+	rdframe *st = NULL;
+	size_t nalloc = 0, depth = 0;
+	rdsync(rd);
+	struct dirent64 **types = rdtypelist(rd);
+	strbld *path = strbld_new(0);
+	strbld_append(path, dirname);
+	int fd = rdopen(AT_FDCWD, dirname, dirname);
+	while (1) {
+		if (fd != -1) {	// push a frame for the dir just opened.
+			if (depth == nalloc) {
+				nalloc = nalloc ? 2 * nalloc : 16;
+				st = realloc(st, nalloc * sizeof(rdframe));
+				if (!st) {
+					fputs("Out of memory.\n", stderr);
+					exit(EXIT_FAILURE);
+				}
+				size_t i;
+				for (i = depth; i < nalloc; i++) st[i].buf = NULL;
+			}
+			if (!st[depth].buf) st[depth].buf = xmalloc(RD_BUFSIZE);
+			st[depth].fd = fd;
+			st[depth].pos = st[depth].len = 0;
+			st[depth].plen = path->len;
+			depth++;
+			fd = -1;
+		}
+		if (!depth) break;
+		rdframe *fp = &st[depth - 1];
+		if (fp->pos >= fp->len) {
+			ssize_t n = getdents64(fp->fd, fp->buf, RD_BUFSIZE);
+			if (n == -1) {
+				strbld_truncate(path, fp->plen);
+				perror(path->buf);
+				exit(EXIT_FAILURE);
+			}
+			if (n == 0) {	// done with this dir.
+				close(fp->fd);
+				depth--;
+				continue;
+			}
+			fp->pos = 0;
+			fp->len = n;
+			if (types) rdtypes(fp->fd, fp->buf, n, types);
+		}
+		struct dirent64 *de = (struct dirent64 *)(fp->buf + fp->pos);
+		fp->pos += de->d_reclen;
 		if (strcmp(de->d_name, ".") == 0 ) continue;
 		if (strcmp(de->d_name, "..") == 0) continue;
-		char joinbuf[PATH_MAX];
-		strcpy(joinbuf, dirname);
-		strjoin(joinbuf, '/', de->d_name, PATH_MAX);
-		/* If there is list of paths to reject check that any dirs
-		 * found are not in rd->rejectlist[] */
-		if ((rd->rejectlist) && de->d_type == DT_DIR) {
-			if(instrlist(joinbuf, rd->rejectlist)) continue;
-		}
-		// Output only file system objects named in rd->fsobj[]
-		if (in_uch_array(de->d_type, rd->fsobj)) {
-			meminsert(joinbuf, ddat, rd->meminc);
-			recs++;
-		}
-		if (de->d_type == DT_DIR) {
-			recursedir(joinbuf, ddat, rd);
+		if (de->d_type == DT_UNKNOWN) de->d_type = rdtype(fp->fd, de->d_name);
+		strbld_truncate(path, fp->plen);
+		strbld_join(path, '/', de->d_name);
+		// Rejected dirs are pruned before they are opened.
+		if (rd && rd->rejects && de->d_type == DT_DIR) {
+			if (rd_rejected(rd, path->buf, de->d_name)) continue;
+		}
+		int act = RD_CONTINUE;
+		if (!rd || in_uch_array(de->d_type, rd->fsobj)) {
+			rd_entry ent = { fp->fd, de->d_name, path->buf, depth,
+								de->d_type };
+			act = fn(&ent, arg);
+			count++;
+		}
+		if (act == RD_STOP) {
+			while (depth) close(st[--depth].fd);
+			break;
+		}
+		if (de->d_type == DT_DIR && act != RD_PRUNE) {
+			fd = rdopen(fp->fd, de->d_name, path->buf);
 		}
 	} // while()
-	doclosedir(dp);
-	return recs;
+	size_t i;
+	for (i = 0; i < nalloc; i++) free(st[i].buf);
+	free(st);
+	free(types);
+	free_strbld(path);
+	return count;
+} // rd_walk()
+
+typedef struct rdcollect {	/* recursedir() state for rdrecord(). */
+	mdata *md;
+	size_t meminc;
+} rdcollect;
+
+static int
+rdrecord(const rd_entry *ent, void *arg)
+{ /* rd_walk() visitor of recursedir(), records the path. */
+	rdcollect *rc = arg;
+	meminsert(ent->path, rc->md, rc->meminc);
+	return RD_CONTINUE;
+} // rdrecord()
+
+int
+recursedir(char *dirname, mdata *ddat, rd_data *rd)
+{ /* Returns count of records recorded by this call.
+	* Caller must init_recursedir() before calling this.
+	* Every path that passes the filters in rd is put in ddat, for
+	* jobs that need no list see rd_walk().
+	*/
+	rdcollect rc = { ddat, rd->meminc };
+	return rd_walk(dirname, rd, rdrecord, &rc);
 } // recursedir()
 
+/* An rd_tree holds each result as its basename and the node of its
+ * parent dir, instead of as a full path, so the common prefixes of a
+ * deep tree are stored once. A node is the offset in nodes of a record
+ * made of the parent's node as a uint32_t, a byte of d_type, and the
+ * name with its '\0', unaligned. A walk's root node is the dirname as
+ * given, with no parent. Dirs that are only on the way to results are
+ * nodes too, but they lack RD_TREEREC and are not counted.
+ * */
+#define RD_TREEREC	0x80	// or'd into the d_type of results.
+#define RD_TREEHEAD	(sizeof(uint32_t) + 1)	// bytes before the name.
+
+rd_tree
+*init_rdtree(void)
+{ /* An empty tree for recursedir_tree(). */
+	rd_tree *tree = xcalloc(1, sizeof(rd_tree));
+	tree->nodes = init_mdata();
+	return tree;
+} // init_rdtree()
+
+void
+free_rdtree(rd_tree *tree)
+{ /* Free tree and all it holds. */
+	free_mdata(tree->nodes);
+	free(tree->chain);
+	free(tree);
+} // free_rdtree()
+
+static size_t
+rdnode(rd_tree *tree, size_t parent, unsigned char d_type,
+				const char *name)
+{ /* Append a node, returning it. */
+	mdata *md = tree->nodes;
+	size_t node = md->to - md->fro;
+	size_t len = strlen(name) + 1;
+	if (node + RD_TREEHEAD + len > UINT32_MAX) {
+		fputs("Walk too big for an rd_tree.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	uint32_t up = (parent == RD_NONE) ? UINT32_MAX : parent;
+	mdata_reserve(md, RD_TREEHEAD + len);
+	memcpy(md->to, &up, sizeof(uint32_t));
+	md->to[sizeof(uint32_t)] = d_type;
+	memcpy(md->to + RD_TREEHEAD, name, len);
+	md->to += RD_TREEHEAD + len;
+	return node;
+} // rdnode()
+
+typedef struct rdtreewalk {	/* recursedir_tree() state for rdtreeadd(). */
+	rd_tree *tree;
+	rd_data *rd;
+	size_t *dirs;	// the node of the dir at each depth.
+	size_t ndirs;
+	int count;
+} rdtreewalk;
+
+static int
+rdtreeadd(const rd_entry *ent, void *arg)
+{ /* rd_walk() visitor of recursedir_tree(). It is given every entry so
+   * that dirs which are not results are still known as parents.
+  */
+	rdtreewalk *tw = arg;
+	int rec = in_uch_array(ent->d_type, tw->rd->fsobj);
+	if (!rec && ent->d_type != DT_DIR) return RD_CONTINUE;
+	unsigned char d_type = ent->d_type | (rec ? RD_TREEREC : 0);
+	size_t node = rdnode(tw->tree, tw->dirs[ent->depth - 1], d_type,
+							ent->name);
+	if (rec) {
+		tw->tree->count++;
+		tw->count++;
+	}
+	if (ent->d_type == DT_DIR) {
+		if (ent->depth == tw->ndirs) {
+			tw->ndirs *= 2;
+			tw->dirs = realloc(tw->dirs, tw->ndirs * sizeof(size_t));
+			if (!tw->dirs) {
+				fputs("Out of memory.\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+		tw->dirs[ent->depth] = node;
+	}
+	return RD_CONTINUE;
+} // rdtreeadd()
+
+int
+recursedir_tree(char *dirname, rd_tree *tree, rd_data *rd)
+{ /* As recursedir() but the results are added to tree, which costs a
+   * few bytes more than the basename for each instead of the whole
+   * path. Get the paths back with rd_tree_next() and rd_tree_path(), or
+   * all at once in recursedir()'s format with rd_tree_export().
+   * Returns the count of results added by this call.
+  */
+	rd_data all = *rd;	// every type goes to rdtreeadd(), which filters.
+	unsigned char types[] = { DT_BLK, DT_CHR, DT_DIR, DT_FIFO, DT_LNK,
+								DT_REG, DT_SOCK, DT_UNKNOWN, 0 };
+	memcpy(all.fsobj, types, sizeof(types));
+	rdtreewalk tw;
+	tw.tree = tree;
+	tw.rd = rd;
+	tw.ndirs = 16;
+	tw.dirs = xmalloc(tw.ndirs * sizeof(size_t));
+	tw.dirs[0] = rdnode(tree, RD_NONE, DT_DIR, dirname);
+	tw.count = 0;
+	rd_walk(dirname, &all, rdtreeadd, &tw);
+	free(tw.dirs);
+	return tw.count;
+} // recursedir_tree()
+
+size_t
+rd_tree_next(rd_tree *tree, size_t node)
+{ /* The first result after node in walk order, or the first of all if
+   * node is RD_NONE. RD_NONE when there are no more.
+  */
+	mdata *md = tree->nodes;
+	size_t off = 0, end = md->to - md->fro;
+	if (node != RD_NONE) off = node + RD_TREEHEAD + strlen(md->fro +
+								node + RD_TREEHEAD) + 1;
+	while (off < end) {
+		if (md->fro[off + sizeof(uint32_t)] & RD_TREEREC) return off;
+		off += RD_TREEHEAD + strlen(md->fro + off + RD_TREEHEAD) + 1;
+	}
+	return RD_NONE;
+} // rd_tree_next()
+
+char
+*rd_tree_path(rd_tree *tree, size_t node, strbld *sb)
+{ /* Put the full path of node in sb, replacing what was there, and
+   * return it. It is spelled as recursedir() would have.
+  */
+	mdata *md = tree->nodes;
+	size_t n = 0;
+	while (1) {
+		if (n == tree->nchain) {
+			tree->nchain = tree->nchain ? 2 * tree->nchain : 16;
+			tree->chain = realloc(tree->chain,
+								tree->nchain * sizeof(char *));
+			if (!tree->chain) {
+				fputs("Out of memory.\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+		tree->chain[n++] = md->fro + node + RD_TREEHEAD;
+		uint32_t up;
+		memcpy(&up, md->fro + node, sizeof(uint32_t));
+		if (up == UINT32_MAX) break;
+		node = up;
+	}
+	strbld_reset(sb);
+	while (n) strbld_join(sb, '/', tree->chain[--n]);
+	return sb->buf;
+} // rd_tree_path()
+
+int
+rd_tree_export(rd_tree *tree, mdata *md, size_t meminc)
+{ /* Append every result in tree to md as recursedir() does, in walk
+   * order. Returns the count appended.
+  */
+	strbld *sb = strbld_new(0);
+	int count = 0;
+	size_t node;
+	for (node = rd_tree_next(tree, RD_NONE); node != RD_NONE;
+				node = rd_tree_next(tree, node)) {
+		meminsert(rd_tree_path(tree, node, sb), md, meminc);
+		count++;
+	}
+	free_strbld(sb);
+	return count;
+} // rd_tree_export()
+
+/* recursedir_par() shares the walk among threads. Each has a deque of
+ * dirs to read, it pushes the subdirs it finds and pops them again from
+ * the bottom, while idle threads steal from the top of other deques.
+ * pending counts dirs pushed but not yet read, the walk ends when it is
+ * 0 and no deque has work. queued counts the dirs still in deques. A
+ * thread that finds none sleeps on idle, to be woken by the next push
+ * or by the end of the walk, so idle threads take no CPU from the rest.
+ * */
+typedef struct rpdeque {
+	pthread_mutex_t lock;
+	char **paths;
+	size_t top, bottom, cap;	// items are [top, bottom).
+} rpdeque;
+
+typedef struct rpwalk {
+	rd_data *rd;
+	int nthreads;
+	rpdeque *dq;
+	mdata **out;	// per thread results.
+	int *recs;	// per thread record counts.
+	long pending;	// dirs queued or being read.
+	long queued;	// dirs in deques.
+	int nidle;	// threads waiting on idle.
+	pthread_mutex_t idlelock;
+	pthread_cond_t idle;
+} rpwalk;
+
+typedef struct rpworker {
+	rpwalk *w;
+	int id;
+} rpworker;
+
+static void
+rppush(rpwalk *w, int id, char *path)
+{ /* Queue path on thread id's deque. */
+	rpdeque *dq = &w->dq[id];
+	__atomic_add_fetch(&w->pending, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&dq->lock);
+	if (dq->bottom == dq->cap) {
+		if (dq->top > 0) {	// reclaim the stolen space first.
+			memmove(dq->paths, dq->paths + dq->top,
+					(dq->bottom - dq->top) * sizeof(char *));
+			dq->bottom -= dq->top;
+			dq->top = 0;
+		}
+		if (dq->bottom == dq->cap) {
+			dq->cap = dq->cap ? 2 * dq->cap : 64;
+			dq->paths = realloc(dq->paths, dq->cap * sizeof(char *));
+			if (!dq->paths) {
+				fputs("Out of memory.\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	dq->paths[dq->bottom++] = path;
+	pthread_mutex_unlock(&dq->lock);
+	__atomic_add_fetch(&w->queued, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&w->nidle, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&w->idlelock);
+		pthread_cond_signal(&w->idle);
+		pthread_mutex_unlock(&w->idlelock);
+	}
+} // rppush()
+
+static char
+*rptake(rpwalk *w, int id)
+{ /* Pop the newest dir from our own deque, or else steal the oldest
+   * from another thread's. NULL if no work was found.
+  */
+	char *path = NULL;
+	rpdeque *dq = &w->dq[id];
+	pthread_mutex_lock(&dq->lock);
+	if (dq->bottom > dq->top) path = dq->paths[--dq->bottom];
+	pthread_mutex_unlock(&dq->lock);
+	int i;
+	for (i = 1; !path && i < w->nthreads; i++) {
+		dq = &w->dq[(id + i) % w->nthreads];
+		pthread_mutex_lock(&dq->lock);
+		if (dq->bottom > dq->top) path = dq->paths[dq->top++];
+		pthread_mutex_unlock(&dq->lock);
+	}
+	if (path) __atomic_sub_fetch(&w->queued, 1, __ATOMIC_SEQ_CST);
+	return path;
+} // rptake()
+
+static void
+rpreaddir(rpwalk *w, int id, char *dirname, char *buf, strbld *path,
+				struct dirent64 **types)
+{ /* Read the one dir, recording entries and queueing subdirs as
+   * recursedir() does. types is NULL or from rdtypelist().
+  */
+	rd_data *rd = w->rd;
+	int fd = rdopen(AT_FDCWD, dirname, dirname);
+	strbld_reset(path);
+	strbld_append(path, dirname);
+	size_t plen = path->len;
+	while (1) {
+		ssize_t n = getdents64(fd, buf, RD_BUFSIZE);
+		if (n == -1) {
+			perror(dirname);
+			exit(EXIT_FAILURE);
+		}
+		if (n == 0) break;
+		if (types) rdtypes(fd, buf, n, types);
+		ssize_t pos = 0;
+		while (pos < n) {
+			struct dirent64 *de = (struct dirent64 *)(buf + pos);
+			pos += de->d_reclen;
+			if (strcmp(de->d_name, ".") == 0 ) continue;
+			if (strcmp(de->d_name, "..") == 0) continue;
+			if (de->d_type == DT_UNKNOWN) de->d_type = rdtype(fd, de->d_name);
+			strbld_truncate(path, plen);
+			strbld_join(path, '/', de->d_name);
+			if (rd->rejects && de->d_type == DT_DIR) {
+				if (rd_rejected(rd, path->buf, de->d_name)) continue;
+			}
+			if (in_uch_array(de->d_type, rd->fsobj)) {
+				meminsert(path->buf, w->out[id], rd->meminc);
+				w->recs[id]++;
+			}
+			if (de->d_type == DT_DIR) {
+				rppush(w, id, xstrdup(path->buf));
+			}
+		}
+	}
+	close(fd);
+} // rpreaddir()
+
+static void
+*rpwork(void *arg)
+{ /* Thread body of recursedir_par(). */
+	rpworker *wk = arg;
+	rpwalk *w = wk->w;
+	char *buf = xmalloc(RD_BUFSIZE);
+	struct dirent64 **types = rdtypelist(w->rd);
+	strbld *path = strbld_new(0);
+	while (1) {
+		char *dirname = rptake(w, wk->id);
+		if (!dirname) {	// others are still reading, wait for work.
+			pthread_mutex_lock(&w->idlelock);
+			__atomic_add_fetch(&w->nidle, 1, __ATOMIC_SEQ_CST);
+			while (__atomic_load_n(&w->queued, __ATOMIC_SEQ_CST) <= 0
+					&& __atomic_load_n(&w->pending, __ATOMIC_SEQ_CST) > 0)
+				pthread_cond_wait(&w->idle, &w->idlelock);
+			__atomic_sub_fetch(&w->nidle, 1, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&w->idlelock);
+			if (__atomic_load_n(&w->pending, __ATOMIC_SEQ_CST) == 0) break;
+			continue;
+		}
+		rpreaddir(w, wk->id, dirname, buf, path, types);
+		free(dirname);
+		if (__atomic_sub_fetch(&w->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+			pthread_mutex_lock(&w->idlelock);	// the walk is over.
+			pthread_cond_broadcast(&w->idle);
+			pthread_mutex_unlock(&w->idlelock);
+		}
+	}
+	free(buf);
+	free(types);
+	free_strbld(path);
+	return NULL;
+} // rpwork()
+
+static int
+rpcmp(const void *a, const void *b)
+{ /* qsort() comparison of two paths. */
+	return strcmp(*(char * const *)a, *(char * const *)b);
+} // rpcmp()
+
+int
+recursedir_par(char *dirname, mdata *ddat, rd_data *rd, int nthreads,
+				int sorted)
+{ /* As recursedir() but the dirs are read by nthreads threads, or one
+   * per online CPU if nthreads is 0. Each thread records into its own
+   * block and the blocks are appended to ddat at the end, so the order
+   * of records is not that of recursedir(). If sorted is non-zero the
+   * new records are sorted by strcmp() instead. Returns the count of
+   * records recorded by this call.
+  */
+	if (nthreads <= 0) nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads <= 0) nthreads = 1;
+	rdsync(rd);
+	rpwalk w;
+	w.rd = rd;
+	w.nthreads = nthreads;
+	w.pending = w.queued = 0;
+	w.nidle = 0;
+	pthread_mutex_init(&w.idlelock, NULL);
+	pthread_cond_init(&w.idle, NULL);
+	w.dq = xcalloc(nthreads, sizeof(rpdeque));
+	w.out = xmalloc(nthreads * sizeof(mdata *));
+	w.recs = xcalloc(nthreads, sizeof(int));
+	rpworker *wk = xmalloc(nthreads * sizeof(rpworker));
+	pthread_t *tids = xmalloc(nthreads * sizeof(pthread_t));
+	int i;
+	for (i = 0; i < nthreads; i++) {
+		pthread_mutex_init(&w.dq[i].lock, NULL);
+		w.out[i] = init_mdata();
+		wk[i].w = &w;
+		wk[i].id = i;
+	}
+	rppush(&w, 0, xstrdup(dirname));
+	for (i = 1; i < nthreads; i++) {
+		if (pthread_create(&tids[i], NULL, rpwork, &wk[i])) {
+			fputs("Could not create thread.\n", stderr);
+			exit(EXIT_FAILURE);
+		}
+	}
+	rpwork(&wk[0]);	// this thread is worker 0.
+	for (i = 1; i < nthreads; i++) pthread_join(tids[i], NULL);
+	int recs = 0;
+	size_t total = 0;
+	for (i = 0; i < nthreads; i++) {
+		recs += w.recs[i];
+		total += w.out[i]->to - w.out[i]->fro;
+	}
+	mdata_reserve(ddat, total);
+	if (sorted) {
+		char **list = xmalloc((recs + 1) * sizeof(char *));
+		int n = 0;
+		for (i = 0; i < nthreads; i++) {
+			char *cp;
+			for (cp = w.out[i]->fro; cp < w.out[i]->to; cp += strlen(cp) + 1)
+				list[n++] = cp;
+		}
+		qsort(list, n, sizeof(char *), rpcmp);
+		int j;
+		for (j = 0; j < n; j++) {
+			size_t len = strlen(list[j]) + 1;
+			memcpy(ddat->to, list[j], len);
+			ddat->to += len;
+		}
+		free(list);
+	} else {
+		for (i = 0; i < nthreads; i++) {
+			size_t len = w.out[i]->to - w.out[i]->fro;
+			if (len) memcpy(ddat->to, w.out[i]->fro, len);
+			ddat->to += len;
+		}
+	}
+	for (i = 0; i < nthreads; i++) {
+		pthread_mutex_destroy(&w.dq[i].lock);
+		free(w.dq[i].paths);
+		free_mdata(w.out[i]);
+	}
+	pthread_mutex_destroy(&w.idlelock);
+	pthread_cond_destroy(&w.idle);
+	vfree(w.dq, w.out, w.recs, wk, tids, NULL);
+	return recs;
+} // recursedir_par()
+
 /*
  * For fsobj below use DT_BLK, DT_CHR, DT_DIR, DT_FIFO, DT_LNK, DT_REG,
  * DT_SOCK, DT_UNKNOWN as required.
+ * Entries the file system gives as DT_UNKNOWN are typed with statx()
+ * as they are met, so DT_UNKNOWN only matches names that vanished in
+ * the meantime. Set RD_TYPEBATCH in rd->flags to type them a buffer at
+ * a time in inode order instead, which helps cold walks of big dirs.
  * Most needs will be met by DT_DIR and DT_REG.
  * DT_DIR will always be needed else the recursion can never happen.
  * Excludes may be NULL and if it is there will be no dirs excluded from
- * the output.
+ * the output. Otherwise each exclude is one of:
+ *   path         the dir with this realpath(), dropped if it has none.
+ *   glob:pattern any dir whose name matches pattern, eg "glob:.git" or
+ *                "glob:build*", see fnmatch(3).
+ *   prefix:str   any dir whose path starts with str, eg "prefix:/tmp/b"
+ *                rejects /tmp/b, /tmp/build and all below them.
+ * Paths are compared as the walk spells them, so exact and prefix rules
+ * only work for walks started from an absolute, normalised dirname.
+ * */
+
+static size_t
+rdhash(const char *path)
+{ /* FNV-1a hash of path for the exact excludes set. */
+	size_t h = 2166136261u;
+	const unsigned char *cp;
+	for (cp = (const unsigned char *)path; *cp; cp++) {
+		h ^= *cp;
+		h *= 16777619u;
+	}
+	return h;
+} // rdhash()
+
+static void
+rdhashpaths(rd_rejects *rj, char **list)
+{ /* Build the hash set of exact paths from list, which keeps the strings. */
+	size_t i, n;
+	for (n = 0; list && list[n]; n++);
+	free(rj->paths);
+	rj->nslots = 8;
+	while (rj->nslots < 2 * n) rj->nslots *= 2;	// keep it half empty.
+	rj->paths = xcalloc(rj->nslots, sizeof(char *));
+	for (i = 0; i < n; i++) {
+		size_t slot = rdhash(list[i]) & (rj->nslots - 1);
+		while (rj->paths[slot] && strcmp(rj->paths[slot], list[i]) != 0)
+			slot = (slot + 1) & (rj->nslots - 1);
+		rj->paths[slot] = list[i];	// a duplicate takes its own slot.
+	}
+	rj->from = list;
+} // rdhashpaths()
+
+static void
+rdcompile(rd_data *rd, char **excludes)
+{ /* Sort excludes into rd's rejectlist, globs and prefixes. */
+	size_t i, n, np = 0;
+	for (n = 0; excludes[n]; n++);
+	rd_rejects *rj = xcalloc(1, sizeof(rd_rejects));
+	rj->globs = xmalloc((n + 1) * sizeof(char *));
+	rj->prefixes = xmalloc((n + 1) * sizeof(char *));
+	rd->rejectlist = xmalloc((n + 1) * sizeof(char *));
+	for (i = 0; i < n; i++) {
+		const char *ex = excludes[i];
+		if (strncmp(ex, "glob:", 5) == 0) {
+			rj->globs[rj->nglobs++] = xstrdup(ex + 5);
+		} else if (strncmp(ex, "prefix:", 7) == 0) {
+			rj->prefixes[rj->nprefixes++] = xstrdup(ex + 7);
+		} else {
+			// deal with non-existence of realpath() some names.
+			char *cp = realpath(ex, NULL);
+			if (cp) rd->rejectlist[np++] = cp;
+		}
+	} // for()
+	rd->rejectlist[np] = NULL;
+	rdhashpaths(rj, rd->rejectlist);
+	rd->rejects = rj;
+} // rdcompile()
+
+static void
+rdsync(rd_data *rd)
+{ /* Rehash the exact paths if the caller has set rd->rejectlist. */
+	if (!rd) return;
+	rd_rejects *rj = rd->rejects;
+	if (rj ? rj->from == rd->rejectlist : !rd->rejectlist) return;
+	if (!rj) rj = rd->rejects = xcalloc(1, sizeof(rd_rejects));
+	rdhashpaths(rj, rd->rejectlist);
+} // rdsync()
+
+int
+rd_rejected(rd_data *rd, const char *path, const char *name)
+{ /* Non-zero if the dir at path, whose basename is name, is excluded
+   * by rd. Exact paths cost one hash probe, whatever their number.
+  */
+	rd_rejects *rj = rd->rejects;
+	if (!rj) return 0;
+	size_t slot = rdhash(path) & (rj->nslots - 1);
+	while (rj->paths[slot]) {
+		if (strcmp(rj->paths[slot], path) == 0) return 1;
+		slot = (slot + 1) & (rj->nslots - 1);
+	}
+	size_t i;
+	for (i = 0; i < rj->nprefixes; i++) {
+		if (strncmp(path, rj->prefixes[i], strlen(rj->prefixes[i])) == 0)
+			return 1;
+	}
+	for (i = 0; i < rj->nglobs; i++) {
+		if (fnmatch(rj->globs[i], name, 0) == 0) return 1;
+	}
+	return 0;
+} // rd_rejected()
+
+/* A snapshot lets recursedir_snap() list dirs that have not changed
+ * since the last walk without reading them, much as git's untracked
+ * cache does. The file is RD_SNAPMAGIC then one record per dir that was
+ * listed: an rdsnaprec, the dir's path and its '\0', then its entries,
+ * each a d_type byte followed by the name and its '\0'. Records are
+ * padded to 8 bytes. Every entry but . and .. is kept and the filters
+ * are applied as they are replayed, so one snapshot serves any rd_data.
  * */
+#define RD_SNAPMAGIC	"rdsnap1\n"
+#define RD_SNAPPAD(n)	(((n) + 7) & ~(size_t)7)
+
+typedef struct rdsnaprec {	/* head of one dir's record. */
+	uint64_t dev;
+	uint64_t ino;	// 0 if the listing must be read again.
+	int64_t mtime[2];	// seconds, nanoseconds.
+	int64_t ctime[2];
+	uint32_t pathlen;	// path bytes that follow, with the '\0'.
+	uint32_t nbytes;	// entry bytes that follow the path.
+} rdsnaprec;
+
+typedef struct rdsnap {	/* the previous snapshot, indexed by path. */
+	mdata *md;	// NULL if there was none.
+	size_t *slots;	// offset of a record + 1, 0 if empty.
+	size_t nslots;	// a power of 2.
+} rdsnap;
+
+typedef struct rdsframe {	/* a dir in the walk of recursedir_snap(). */
+	char *ents;	// its entries in snapshot form.
+	size_t pos;	// next entry.
+	size_t len;
+	size_t plen;	// length of the dir's path.
+	char *own;	// ents if this walk read them, to be freed.
+} rdsframe;
+
+static void
+rdsnap_load(rdsnap *sp, const char *snapfile)
+{ /* Map snapfile and index its records by path. If it is missing or
+   * damaged sp is left empty, so that every dir is read.
+  */
+	memset(sp, 0, sizeof(rdsnap));
+	mdata *md = readfile_map(snapfile, 0, 0);
+	if (!md) return;
+	size_t size = md->to - md->fro, mlen = strlen(RD_SNAPMAGIC);
+	if (size < mlen || memcmp(md->fro, RD_SNAPMAGIC, mlen) != 0) {
+		free_mdata(md);
+		return;
+	}
+	size_t n = 0, off;
+	for (off = mlen; off < size; n++) {	// check, then count.
+		if (size - off < sizeof(rdsnaprec)) break;
+		rdsnaprec *rec = (rdsnaprec *)(md->fro + off);
+		char *path = (char *)(rec + 1);
+		size_t len = sizeof(rdsnaprec) + (size_t)rec->pathlen + rec->nbytes;
+		if (!rec->pathlen || len > size - off) break;
+		if (path[rec->pathlen - 1]) break;
+		if (rec->nbytes && path[rec->pathlen + rec->nbytes - 1]) break;
+		off += RD_SNAPPAD(len);
+	}
+	if (off < size) {
+		fprintf(stderr, "%s: damaged snapshot, rebuilding it.\n", snapfile);
+		free_mdata(md);
+		return;
+	}
+	sp->nslots = 8;
+	while (sp->nslots < 2 * n) sp->nslots *= 2;	// keep it half empty.
+	sp->slots = xcalloc(sp->nslots, sizeof(size_t));
+	for (off = mlen; off < size; ) {
+		rdsnaprec *rec = (rdsnaprec *)(md->fro + off);
+		size_t slot = rdhash((char *)(rec + 1)) & (sp->nslots - 1);
+		while (sp->slots[slot]) slot = (slot + 1) & (sp->nslots - 1);
+		sp->slots[slot] = off + 1;
+		off += RD_SNAPPAD(sizeof(rdsnaprec) + rec->pathlen + rec->nbytes);
+	}
+	sp->md = md;
+} // rdsnap_load()
+
+static rdsnaprec
+*rdsnap_find(rdsnap *sp, const char *path)
+{ /* The record of the dir at path in sp, NULL if it has none. */
+	if (!sp->md) return NULL;
+	size_t slot = rdhash(path) & (sp->nslots - 1);
+	while (sp->slots[slot]) {
+		rdsnaprec *rec = (rdsnaprec *)(sp->md->fro + sp->slots[slot] - 1);
+		if (strcmp((char *)(rec + 1), path) == 0) return rec;
+		slot = (slot + 1) & (sp->nslots - 1);
+	}
+	return NULL;
+} // rdsnap_find()
+
+static void
+rdsnap_list(rdsframe *fp, const char *path, rdsnap *old, mdata *snap,
+				time_t start, char *buf, struct dirent64 **types)
+{ /* Give fp the entries of the dir at path, from old if its inode and
+   * times are as recorded there, or else read with getdents64() using
+   * buf, with rdtypes() if types is not NULL. Either way the listing is
+   * recorded in snap.
+  */
+	struct stat sb;
+	if (fstatat(AT_FDCWD, path, &sb, 0) == -1) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	rdsnaprec rec;
+	memset(&rec, 0, sizeof(rdsnaprec));
+	rec.dev = sb.st_dev;
+	rec.ino = sb.st_ino;
+	rec.mtime[0] = sb.st_mtim.tv_sec;
+	rec.mtime[1] = sb.st_mtim.tv_nsec;
+	rec.ctime[0] = sb.st_ctim.tv_sec;
+	rec.ctime[1] = sb.st_ctim.tv_nsec;
+	rdsnaprec *was = rdsnap_find(old, path);
+	fp->own = NULL;
+	if (was && was->ino && was->ino == rec.ino && was->dev == rec.dev
+			&& memcmp(was->mtime, rec.mtime, sizeof(rec.mtime)) == 0
+			&& memcmp(was->ctime, rec.ctime, sizeof(rec.ctime)) == 0) {
+		fp->ents = (char *)(was + 1) + was->pathlen;
+		fp->len = was->nbytes;
+	} else {
+		strbld *ents = strbld_new(0);
+		int fd = rdopen(AT_FDCWD, path, path);
+		while (1) {
+			ssize_t n = getdents64(fd, buf, RD_BUFSIZE);
+			if (n == -1) {
+				perror(path);
+				exit(EXIT_FAILURE);
+			}
+			if (n == 0) break;
+			if (types) rdtypes(fd, buf, n, types);
+			ssize_t pos = 0;
+			while (pos < n) {
+				struct dirent64 *de = (struct dirent64 *)(buf + pos);
+				pos += de->d_reclen;
+				if (strcmp(de->d_name, ".") == 0 ) continue;
+				if (strcmp(de->d_name, "..") == 0) continue;
+				if (de->d_type == DT_UNKNOWN)
+					de->d_type = rdtype(fd, de->d_name);
+				strbld_appendn(ents, (char *)&de->d_type, 1);
+				strbld_appendn(ents, de->d_name, strlen(de->d_name) + 1);
+			}
+		}
+		close(fd);
+		fp->len = ents->len;
+		fp->ents = fp->own = strbld_detach(ents);
+	}
+	/* A dir changed in the second the walk began in may change again
+	 * without its times moving, so it is read again next time. */
+	if (rec.mtime[0] >= start || rec.ctime[0] >= start) rec.ino = 0;
+	rec.pathlen = strlen(path) + 1;
+	rec.nbytes = fp->len;
+	size_t len = sizeof(rdsnaprec) + rec.pathlen + rec.nbytes;
+	mdata_reserve(snap, RD_SNAPPAD(len));
+	memcpy(snap->to, &rec, sizeof(rdsnaprec));
+	memcpy(snap->to + sizeof(rdsnaprec), path, rec.pathlen);
+	if (fp->len)
+		memcpy(snap->to + sizeof(rdsnaprec) + rec.pathlen, fp->ents, fp->len);
+	memset(snap->to + len, 0, RD_SNAPPAD(len) - len);
+	snap->to += RD_SNAPPAD(len);
+} // rdsnap_list()
+
+int
+recursedir_snap(char *dirname, mdata *ddat, rd_data *rd,
+				const char *snapfile)
+{ /* As recursedir() but each dir is listed from snapfile when its
+   * inode, mtime and ctime are those recorded there, so a warm walk of
+   * a mostly unchanged tree costs about one fstatat() per dir. Other
+   * dirs are read, and the snapshot is rewritten atomically at the end
+   * with the listings of every dir this walk entered. It is created if
+   * it does not exist. A listing is replayed in the order the dir was
+   * read, so the records are those recursedir() would make. Returns the
+   * count of records recorded by this call.
+  */
+	rdsync(rd);
+	rdsnap old;
+	rdsnap_load(&old, snapfile);
+	mdata *snap = init_mdata();
+	size_t mlen = strlen(RD_SNAPMAGIC);
+	mdata_reserve(snap, mlen);
+	memcpy(snap->to, RD_SNAPMAGIC, mlen);
+	snap->to += mlen;
+	// file times come from the coarse clock, never ahead of this.
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+	char *buf = xmalloc(RD_BUFSIZE);
+	struct dirent64 **types = rdtypelist(rd);
+	int count = 0, enter = 1;
+	rdsframe *st = NULL;
+	size_t nalloc = 0, depth = 0;
+	strbld *path = strbld_new(0);
+	strbld_append(path, dirname);
+	while (1) {
+		if (enter) {	// push a frame for the dir at path.
+			if (depth == nalloc) {
+				nalloc = nalloc ? 2 * nalloc : 16;
+				st = realloc(st, nalloc * sizeof(rdsframe));
+				if (!st) {
+					fputs("Out of memory.\n", stderr);
+					exit(EXIT_FAILURE);
+				}
+			}
+			rdsframe *fp = &st[depth++];
+			fp->pos = 0;
+			fp->plen = path->len;
+			rdsnap_list(fp, path->buf, &old, snap, now.tv_sec, buf,
+						types);
+			enter = 0;
+		}
+		if (!depth) break;
+		rdsframe *fp = &st[depth - 1];
+		if (fp->pos >= fp->len) {	// done with this dir.
+			free(fp->own);
+			depth--;
+			continue;
+		}
+		unsigned char d_type = fp->ents[fp->pos];
+		char *name = fp->ents + fp->pos + 1;
+		fp->pos += strlen(name) + 2;
+		strbld_truncate(path, fp->plen);
+		strbld_join(path, '/', name);
+		if (rd->rejects && d_type == DT_DIR) {
+			if (rd_rejected(rd, path->buf, name)) continue;
+		}
+		if (in_uch_array(d_type, rd->fsobj)) {
+			meminsert(path->buf, ddat, rd->meminc);
+			count++;
+		}
+		if (d_type == DT_DIR) enter = 1;
+	} // while()
+	writemdata(snapfile, snap, WF_ATOMIC);
+	free_mdata(snap);
+	if (old.md) free_mdata(old.md);
+	free(old.slots);
+	free(st);
+	free(buf);
+	free(types);
+	free_strbld(path);
+	return count;
+} // recursedir_snap()
 
 rd_data
 *init_recursedir(char **excludes, size_t meminc, /*d_type*/...)
@@ -84,18 +999,7 @@ rd_data
 	rd_data *rd = xmalloc(sizeof(rd_data));
 	memset(rd, 0, sizeof(rd_data));
 	rd->meminc = meminc;
-	if (excludes) {	// excludes may be NULL
-		size_t i, j, n;
-		for (i = 0; excludes[i] ; i++);
-		n = i + 1;
-		rd->rejectlist = xmalloc(n * sizeof(char *));
-		memset(rd->rejectlist, 0, n * sizeof(char *));
-		for (i = 0, j = 0; i < n; i++) {
-			// deal with non-existence of realpath() some names.
-			char *cp = realpath(excludes[i], NULL);
-			if (cp) rd->rejectlist[j++] = cp;
-		} // for()
-	} // if()
+	if (excludes) rdcompile(rd, excludes);	// else rejects stays NULL.
 	int i = 0;
 	va_list ap;
 	va_start(ap, meminc);
@@ -112,15 +1016,23 @@ rd_data
 
 void
 free_recursedir(rd_data *rd, mdata *md)
-{ /* free resources allocated by init_recursedir() */
+{ /* free resources allocated by init_recursedir(), and md if not NULL. */
+	size_t i;
 	if (rd->rejectlist) {
-		int i;
 		for (i = 0; rd->rejectlist[i]; i++) free(rd->rejectlist[i]);
 		free(rd->rejectlist);
 	}
+	rd_rejects *rj = rd->rejects;
+	if (rj) {	// paths points into rejectlist.
+		for (i = 0; i < rj->nglobs; i++) free(rj->globs[i]);
+		for (i = 0; i < rj->nprefixes; i++) free(rj->prefixes[i]);
+		free(rj->globs);
+		free(rj->prefixes);
+		free(rj->paths);
+		free(rj);
+	}
 	free(rd);
-	free(md->fro);
-	free(md);
+	if (md) free_mdata(md);
 } // free_recursedir()
 
 void
@@ -144,31 +1056,46 @@ newdir(const char *p, int mayexist)
 		perror(p);
 		exit(EXIT_FAILURE);
 	}
+	fs_invalidate(p);
 } // newdir()
 
 void
 xchdir(const char *path)
-{/* Just chdir() with error handling. */
+{/* Just chdir() with error handling. Relative paths in the fs_stat()
+  * cache now name other objects, so it is emptied.
+*/
 	if (chdir(path) == -1) {
 		perror(path);
 		exit(EXIT_FAILURE);
 	}
+	fs_invalidate(NULL);
 } // xchdir()
 
 int
 exists_dir(const char *path)
 { /* return 1 if the dir exists, 0 otherwise */
-	struct stat sb;
-	int res = stat(path, &sb);
-	if (res == -1) {
-		res = 0;
-	} else {
-		res = 1;
-	}
-	if (res && S_ISDIR(sb.st_mode)) {
-		res = 1;
-	} else {
-		res = 0;
-	}
-	return res;
+	fsinfo fi;
+	if (fs_stat(path, 0, STATX_TYPE, &fi) == -1) return 0;
+	return S_ISDIR(fi.mode) ? 1 : 0;
 } // exists_dir()
+
+strlist
+*dirnames(const char *path)
+{ /* Return the names in dir path, less "." and "..", or NULL if it can
+   * not be read. One pass of getdents() stands in for a stat() of every
+   * name that might be there.
+  */
+	DIR *dp = opendir(path);
+	if (!dp) return (strlist *)NULL;
+	strbld *sb = strbld_new(0);
+	struct dirent *de;
+	while ((de = readdir(dp))) {
+		if (strcmp(de->d_name, ".") == 0) continue;
+		if (strcmp(de->d_name, "..") == 0) continue;
+		strbld_join(sb, '/', de->d_name);	// '/' is never in a name.
+	}
+	doclosedir(dp);
+	strlist *sl = strlist_split(sb->buf, "/");
+	free_strbld(sb);
+	return sl;
+} // dirnames()
@@ -41,12 +41,59 @@
 #include <linux/limits.h>
 #include <libgen.h>
 #include <errno.h>
+#include <fnmatch.h>
+#include <stdint.h>
+#include <time.h>
 #include "str.h"
 #include "files.h"
 
+#define RD_BUFSIZE	(1 << 16)	// getdents64() buffer per level of a walk.
+
+#define RD_CONTINUE	0	// rd_walk() visitor results.
+#define RD_PRUNE	1	// do not descend into this dir.
+#define RD_STOP	2	// end the walk now.
+
+#define RD_TYPEBATCH	1	// rd_data flags, resolve DT_UNKNOWN a buffer at a time.
+
+typedef struct rd_entry {	/* an entry as rd_walk() found it. */
+	int dirfd;	// open fd of the dir that holds name.
+	const char *name;
+	const char *path;	// the walk's dirname joined with the names below.
+	size_t depth;	// 1 for entries in the walk's dirname.
+	unsigned char d_type;
+} rd_entry;
+
+typedef int (*rd_visitor)(const rd_entry *ent, void *arg);
+
+typedef struct rd_rejects {	/* excludes compiled by init_recursedir(). */
+	char **paths;	// hash set of exact paths, slot NULL if empty.
+	size_t nslots;	// a power of 2.
+	char **globs;	// fnmatch() patterns for the basename.
+	size_t nglobs;
+	char **prefixes;	// rejects any path starting with one.
+	size_t nprefixes;
+	char **from;	// the rejectlist paths was built from.
+} rd_rejects;
+
+#define RD_NONE	((size_t)-1)	// no rd_tree node.
+
+typedef struct rd_tree {	/* walk results as a trie, see recursedir_tree(). */
+	mdata *nodes;	// parent node, d_type and name of each, in walk order.
+	size_t count;	// nodes that are results.
+	const char **chain;	// names gathered by rd_tree_path().
+	size_t nchain;
+} rd_tree;
+
 typedef struct rd_data {
+	/* Deprecated, kept for callers that read or set it. The realpath()s
+	 * of the plain excludes, NULL terminated. A list set here replaces
+	 * the exact paths of rejects when the next walk starts, and is freed
+	 * by free_recursedir(). The walks only consult rejects.
+	 * */
 	char **rejectlist;
+	rd_rejects *rejects;	// NULL if there are no excludes.
 	size_t meminc;
+	int flags;	// RD_TYPEBATCH or 0.
 	unsigned char fsobj[9];
 } rd_data;
 
@@ -57,6 +104,9 @@ rd_data
 void
 free_recursedir(rd_data *rd, mdata *md);
 
+int
+rd_rejected(rd_data *rd, const char *path, const char *name);
+
 DIR
 *dopendir(const char *dirname);
 
@@ -66,6 +116,35 @@ doclosedir(DIR *dp);
 int
 recursedir(char *dirname, mdata *ddat, rd_data *rd);
 
+int
+rd_walk(const char *dirname, rd_data *rd, rd_visitor fn, void *arg);
+
+int
+recursedir_par(char *dirname, mdata *ddat, rd_data *rd, int nthreads,
+				int sorted);
+
+int
+recursedir_snap(char *dirname, mdata *ddat, rd_data *rd,
+				const char *snapfile);
+
+rd_tree
+*init_rdtree(void);
+
+void
+free_rdtree(rd_tree *tree);
+
+int
+recursedir_tree(char *dirname, rd_tree *tree, rd_data *rd);
+
+size_t
+rd_tree_next(rd_tree *tree, size_t node);
+
+char
+*rd_tree_path(rd_tree *tree, size_t node, strbld *sb);
+
+int
+rd_tree_export(rd_tree *tree, mdata *md, size_t meminc);
+
 void
 newdir(const char *dname, int mayexist);
 
@@ -75,4 +154,7 @@ xchdir(const char *);
 int
 exists_dir(const char *);
 
+strlist
+*dirnames(const char *path);
+
 #endif
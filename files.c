@@ -24,6 +24,14 @@
  * */
 
 #include "files.h"
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <sys/syscall.h>
+#endif
+#if defined(IORING_FEAT_CQE_SKIP) && defined(__NR_io_uring_setup)
+#define FOP_RING 1	// the headers know IORING_OP_LINKAT.
+#endif
 
 void
 writestrarray(char **list)
@@ -38,7 +46,7 @@ char
 { /* Read file at path. File to have lines terminated with '\n'.
    * Returns list of C strings with NULL terminated list.
 */
-	mdata *md = readfile(path, 1, 0);
+	mdata *md = readfile_map(path, 1, 0);
 	int n = memlinestostr(md);
 	if (!n)
 	{
@@ -53,10 +61,9 @@ getfile_mtime(const char *path)
 {/* get the modification time of a file if it exists.
   * No interest in micro seconds for this purpose.
 */
-	struct stat sb;
-	int res = lstat(path, &sb);
-	if (res == -1) return 0;	// 1970-01-01
-	return sb.st_mtime;
+	fsinfo fi;
+	if (fs_stat(path, FS_NOFOLLOW, STATX_MTIME, &fi) == -1) return 0;
+	return fi.mtime.tv_sec;	// 0 is 1970-01-01
 } // getfile_mtime()
 
 int
@@ -67,6 +74,7 @@ xsystem(const char *cmd, int fatal)
    * the caller.
 */
 	const int status = system(cmd);
+	fs_invalidate(NULL);	// no telling what cmd changed.
 	if (status == -1) {	// this always fatal
 		fprintf(stderr, "system failed to execute: %s\n", cmd);
 		exit(EXIT_FAILURE);
@@ -86,24 +94,34 @@ xsystem(const char *cmd, int fatal)
 void
 dumpstrblock(const char *tmpfn, mdata *md)
 { /* Dumps the block of C strings named by md to the file named by
-   * tmpfn. The block will be altered to a block of lines terminated by
-   * '\n', then written to tmpfn and restored to C strings before
-   * returning. Tmpfn may be "-" to write to stdout.
+   * tmpfn, each terminated by '\n'. The block is not altered, each
+   * string and its '\n' are gathered into the one writefilev().
+   * Tmpfn may be "-" to write to stdout.
 */
-	memstrtolines(md);
-	writefile(tmpfn, md->fro, md->to, "w");
-	memlinestostr(md);
+	size_t n = 0;
+	char *cp;
+	for (cp = md->fro; cp < md->to; cp += strlen(cp) + 1) n++;
+	struct iovec *iov = xmalloc((2 * n + 1) * sizeof(struct iovec));
+	size_t i = 0;
+	for (cp = md->fro; cp < md->to; cp += strlen(cp) + 1) {
+		iov[i].iov_base = cp;
+		iov[i++].iov_len = strlen(cp);
+		iov[i].iov_base = "\n";
+		iov[i++].iov_len = 1;
+	}
+	writefilev(tmpfn, iov, i, 0);
+	free(iov);
 } // dumpstrblock()
 
 ino_t
 getinode(const char *path)
 {	/* return the inode number if the path exists, if not abort */
-	struct stat sb;
-	if (lstat(path, &sb) == -1) {
+	fsinfo fi;
+	if (fs_stat(path, FS_NOFOLLOW, STATX_INO, &fi) == -1) {
 		perror(path);
 		exit(EXIT_FAILURE);
 	}
-	return sb.st_ino;
+	return fi.ino;
 } // getinode()
 
 void
@@ -111,6 +129,7 @@ touch(const char *fn)
 {/* Emulates the simplest use of the shell touch command. */
 	FILE *fp = dofopen(fn, "a");	// avoid zeroing an existing file.
 	dofclose(fp);
+	fs_invalidate(fn);
 } // touch()
 
 void
@@ -126,22 +145,24 @@ str2file(const char *fn, const char *s, const char *mode)
 		fprintf(stderr, "Mode value %s not permitted.\n", mode);
 		exit(EXIT_FAILURE);
 	}
-	size_t len = strlen(s);
-	char *buf = xmalloc(len + 1);
-	strcpy(buf, s);
-	buf[len] = '\n';
-	writefile(fn, buf, buf+len+1, mode);
-	free(buf);
+	struct iovec iov[2] = {
+		{ (char *)s, strlen(s) },
+		{ "\n", 1 },
+	};
+	writefilev(fn, iov, 2, a ? WF_APPEND : 0);
 } // str2file()
 
 FILE
 *dofopen(const char *fn, const char *fmode)
-{	/* fopen() with error handling. */
+{	/* fopen() with error handling. A file opened to be written is
+	 * dropped from the fs_stat() cache.
+	*/
 	FILE *fpx = fopen(fn, fmode);
 	if (!fpx) {
 		perror(fn);
 		exit(EXIT_FAILURE);
 	}
+	if (fmode[0] != 'r' || strchr(fmode, '+')) fs_invalidate(fn);
 	return fpx;
 } // untitled()
 
@@ -166,24 +187,185 @@ writefile(const char *filename, char *fro, char *to, const char *fmode)
 	if (!instrlist(fmode, list)) {
 		fputs("whoopee duck.", stderr);
 	}
+	struct iovec iov = { fro, (size_t)len };
+	writefilev(filename, &iov, 1, (fmode[0] == 'a') ? WF_APPEND : 0);
+} // writefile()
 
-	FILE *fpo;
-	int closeit = 1;
-	if (strcmp("-", filename) == 0) {
-		fpo = stdout;
-		closeit = 0;
+static void
+writeallv(int fd, const char *path, const struct iovec *iov, size_t count)
+{	/* writev() all of iov to fd, in batches of at most IOV_MAX and
+	 * resuming after short writes. Errors are fatal.
+	*/
+	struct iovec part[IOV_MAX];
+	size_t i = 0, off = 0;	// next byte is at iov[i] + off.
+	while (i < count) {
+		if (off == iov[i].iov_len) {	// done with it, or it is empty.
+			i++;
+			off = 0;
+			continue;
+		}
+		part[0].iov_base = (char *)iov[i].iov_base + off;
+		part[0].iov_len = iov[i].iov_len - off;
+		int n = 1;
+		size_t j;
+		for (j = i + 1; j < count && n < IOV_MAX; j++) part[n++] = iov[j];
+		ssize_t w = writev(fd, part, n);
+		if (w == -1 && errno == EINTR) continue;
+		if (w == -1) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		while (w > 0) {	// step past what was written.
+			size_t rest = iov[i].iov_len - off;
+			if ((size_t)w < rest) {
+				off += w;
+				break;
+			}
+			w -= rest;
+			i++;
+			off = 0;
+		}
 	}
-	else fpo = dofopen(filename, fmode);
-	size_t written = fwrite(fro, 1, (size_t)len, fpo);
-	if (written != (size_t)len) {
-		perror("writefile");
-		fprintf(stderr,
-				"Expected to write: %ld bytes, but wrote %lu bytes.\n",
-				len, written);
+} // writeallv()
+
+static char
+*tempname(const char *path, char *buf)
+{	/* Make a name for a temporary file beside path in buf, which must
+	 * be PATH_MAX in size. Names are unique within the process.
+	*/
+	static unsigned long seq;
+	unsigned long n = __atomic_fetch_add(&seq, 1, __ATOMIC_RELAXED);
+	if (snprintf(buf, PATH_MAX, "%s.%d.%lu.tmp", path, (int)getpid(), n)
+			>= PATH_MAX) {
+		fprintf(stderr, "Path too long: %s\n", path);
 		exit(EXIT_FAILURE);
 	}
-	if (closeit) dofclose(fpo);
-} // writefile()
+	return buf;
+} // tempname()
+
+static int
+opentemp(const char *path, char *tmpname)
+{	/* Create a new file beside path for writing, named in tmpname which
+	 * must be PATH_MAX in size. Returns its fd.
+	*/
+	while (1) {
+		int fd = open(tempname(path, tmpname),
+						O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+		if (fd != -1) return fd;
+		if (errno != EEXIST) {
+			perror(tmpname);
+			exit(EXIT_FAILURE);
+		}
+	}
+} // opentemp()
+
+static void
+dorename(const char *fro, const char *to)
+{	/* rename() with error handling. */
+	if (rename(fro, to) == -1) {
+		perror(to);
+		unlink(fro);
+		exit(EXIT_FAILURE);
+	}
+	fs_invalidate(fro);
+	fs_invalidate(to);
+} // dorename()
+
+static int
+linktmp(int fd, const char *to)
+{	/* Give the O_TMPFILE open at fd the name to. Linking it with
+	 * AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH and through /proc/self/fd
+	 * needs /proc, so both are tried. Returns 0 or -1 with errno set.
+	*/
+	if (linkat(fd, "", AT_FDCWD, to, AT_EMPTY_PATH) == 0) return 0;
+	if (errno == EEXIST) return -1;
+	char fdpath[32];
+	sprintf(fdpath, "/proc/self/fd/%d", fd);
+	return linkat(AT_FDCWD, fdpath, AT_FDCWD, to, AT_SYMLINK_FOLLOW);
+} // linktmp()
+
+void
+writefilev(const char *path, const struct iovec *iov, size_t count,
+			int flags)
+{	/* Write the pieces of data listed in iov to path, in order, with as
+	 * few writev() calls as possible and without joining them first.
+	 * The file is truncated unless flags has WF_APPEND. With WF_ATOMIC
+	 * the data goes to an unnamed O_TMPFILE in the same directory, or a
+	 * temporary file there if that can not be made or linked, which takes
+	 * the place of path in one step, so readers see either the old or
+	 * the new file complete. The new file gets default permissions.
+	 * Path may be "-" for stdout, flags are then ignored.
+	*/
+	if (strcmp("-", path) == 0) {
+		writeallv(STDOUT_FILENO, path, iov, count);
+		return;
+	}
+	if ((flags & WF_ATOMIC) && (flags & WF_APPEND)) {
+		fputs("writefilev(): WF_ATOMIC and WF_APPEND are exclusive.\n",
+				stderr);
+		exit(EXIT_FAILURE);
+	}
+	if (!(flags & WF_ATOMIC)) {
+		int oflags = O_WRONLY | O_CREAT | O_CLOEXEC;
+		oflags |= (flags & WF_APPEND) ? O_APPEND : O_TRUNC;
+		int fd = open(path, oflags, 0666);
+		if (fd == -1) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		writeallv(fd, path, iov, count);
+		if (close(fd) == -1) {
+			perror(path);
+			exit(EXIT_FAILURE);
+		}
+		fs_invalidate(path);
+		return;
+	}
+	char dir[PATH_MAX], tmpname[PATH_MAX];
+	strcpy(dir, path);	// dirname() may alter its argument.
+	int named = 0;	// tmpname is written, to be renamed over path.
+	int fd = open(dirname(dir), O_TMPFILE | O_WRONLY | O_CLOEXEC, 0666);
+	if (fd != -1) {
+		writeallv(fd, path, iov, count);
+		if (linktmp(fd, path) == 0) {	// path did not exist.
+			if (close(fd) == -1) {	// eg a delayed NFS write error.
+				perror(path);
+				unlink(path);
+				exit(EXIT_FAILURE);
+			}
+			fs_invalidate(path);
+			return;
+		}
+		while (errno == EEXIST) {	// a temporary name to rename() over path.
+			if (linktmp(fd, tempname(path, tmpname)) == 0) {
+				named = 1;
+				break;
+			}
+		}
+		if (close(fd) == -1 && named) {
+			perror(path);
+			unlink(tmpname);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (!named) {	// no O_TMPFILE, or no way to link it, eg no /proc.
+		fd = opentemp(path, tmpname);
+		writeallv(fd, tmpname, iov, count);
+		if (close(fd) == -1) {
+			perror(tmpname);
+			unlink(tmpname);
+			exit(EXIT_FAILURE);
+		}
+	}
+	dorename(tmpname, path);
+} // writefilev()
+
+void
+writemdata(const char *path, mdata *md, int flags)
+{	/* Write the data of md to path with writefilev(). */
+	struct iovec iov = { md->fro, md->to - md->fro };
+	writefilev(path, &iov, 1, flags);
+} // writemdata()
 
 
 mdata
@@ -192,64 +374,101 @@ mdata
 	 * exist, but will return NULL instead. All other errors are always
 	 * fatal. If extra is non-zero will provide extra space, init to 0.
 	*/
-	mdata *ret = NULL;
-	if (exists_file(path)) {
-		ret = malloc(sizeof(mdata));
-		if (!ret) {
-			fputs("Out of memory.\n", stderr);
-			exit(EXIT_FAILURE);
-		}
-		size_t fsize = getfsize(path);
-		size_t blocksize = fsize + extra;
-		ret->fro = malloc(blocksize);
-		memset(ret->fro, 0, blocksize);
-		FILE *fp = dofopen(path, "r");
-		size_t bread = fread(ret->fro, 1, fsize, fp);
-		dofclose(fp);
-		if (bread != fsize) {
-			fprintf(stderr,
-			"Expected to get %lu bytes, but got %lu bytes.\n",
-			fsize, bread);
+	fsinfo fi;
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || fs_fstat(fd, STATX_TYPE | STATX_SIZE, &fi) == -1
+			|| !S_ISREG(fi.mode)) {
+		if (fd != -1) close(fd);
+		if (!fatal) return NULL;
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	mdata *ret = init_mdata();
+	size_t fsize = fi.size;
+	size_t blocksize = fsize + extra;
+	ret->fro = xmalloc(blocksize);	// only extra needs zeroing.
+	memset(ret->fro + fsize, 0, extra);
+	size_t bread = 0;
+	while (bread < fsize) {
+		ssize_t n = read(fd, ret->fro + bread, fsize - bread);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) {
+			perror(path);
 			exit(EXIT_FAILURE);
 		}
-		ret->to = ret->fro + fsize;
-		ret->limit = ret->fro + blocksize;
-	} else if (fatal) {
-		perror(path);
+		if (n == 0) break;
+		bread += n;
+	}
+	close(fd);
+	if (bread != fsize) {
+		fprintf(stderr,
+		"Expected to get %lu bytes, but got %lu bytes.\n",
+		fsize, bread);
 		exit(EXIT_FAILURE);
 	}
+	ret->to = ret->fro + fsize;
+	ret->limit = ret->fro + blocksize;
 	return ret;
 } //readfile()
 
+mdata
+*readfile_map(const char *path, int fatal, int writable)
+{	/* As readfile() with no extra space, but the file is mapped into
+	 * memory instead of being copied to the heap. The mapping is
+	 * private so the data may be altered without that reaching the
+	 * file, and it is flagged MD_FILEMAP so that free_mdata() unmaps it.
+	 * Do not truncate or rewrite the file while the mapping is in use,
+	 * touching the lost pages then raises SIGBUS. If the caller will
+	 * write back to path, pass writable as non-zero to get a heap copy
+	 * from readfile() instead. That is also what is done for files too
+	 * small to be worth mapping, or that can not be mapped.
+	*/
+	if (writable) return readfile(path, fatal, 0);
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	fsinfo fi;
+	if (fd == -1 || fs_fstat(fd, STATX_TYPE | STATX_SIZE, &fi) == -1
+			|| !S_ISREG(fi.mode)) {
+		if (fd != -1) close(fd);
+		if (!fatal) return NULL;
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	size_t fsize = fi.size;
+	if (fsize < MD_FILEMAPMIN) {
+		close(fd);
+		return readfile(path, fatal, 0);
+	}
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);	// bigger readahead.
+	void *p = mmap(NULL, fsize, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) return readfile(path, fatal, 0);
+	madvise(p, fsize, MADV_SEQUENTIAL);
+	mdata *ret = init_mdata();
+	ret->fro = p;
+	ret->to = ret->limit = ret->fro + fsize;
+	ret->flags = MD_FILEMAP;
+	return ret;
+} // readfile_map()
+
 int
 exists_file(const char *path)
 {	/* returns 1 if I can stat the object and it's a regular file,
 	*  0 otherwise */
-	struct stat sb;
-	int res = stat(path, &sb);
-	if (res == -1) {
-		res = 0;
-	} else {
-		res = 1;
-	}
-	if (res && S_ISREG(sb.st_mode)) {
-		res = 1;
-	} else {
-		res = 0;
-	}
-	return res;
+	fsinfo fi;
+	if (fs_stat(path, 0, STATX_TYPE, &fi) == -1) return 0;
+	return S_ISREG(fi.mode) ? 1 : 0;
 } // exists_file()
 
 off_t
 getfsize(const char *path)
 {	/* returns file size if path exists, fatal otherwise */
-	struct stat sb;
-	int res = stat(path, &sb);
-	if (res == -1) {
+	fsinfo fi;
+	if (fs_stat(path, 0, STATX_SIZE, &fi) == -1) {
 		perror(path);
 		exit(EXIT_FAILURE);
 	}
-	return sb.st_size;
+	return fi.size;
 } // getfsize()
 
 mdata
@@ -261,12 +480,116 @@ mdata
 	return cfd;
 } // getconfigfile()
 
+static int
+copyfallback(int err)
+{/* Non-zero if err means a copy method is not available for this pair
+  * of files, so the next one should be tried.
+*/
+	return (err == ENOSYS || err == EXDEV || err == EINVAL
+			|| err == EOPNOTSUPP || err == ETXTBSY);
+} // copyfallback()
+
+static int
+copyfds(int in, int out, off_t left, const char *pathfro,
+			const char *pathto, const char **bad)
+{/* Copy the data of copyfile(), left bytes or to EOF if that is 0.
+  * Returns 0, or -1 with errno set and *bad the path to blame.
+*/
+	*bad = pathto;
+#ifdef FICLONE
+	if (left && ioctl(out, FICLONE, in) == 0) return 0;
+#endif
+	while (left > 0) {
+		ssize_t n = copy_file_range(in, NULL, out, NULL, left, 0);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && copyfallback(errno)) break;
+		if (n == -1) return -1;
+		if (n == 0) break;	// source got shorter.
+		left -= n;
+	}
+	while (left > 0) {
+		ssize_t n = sendfile(out, in, NULL, left);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1 && copyfallback(errno)) break;
+		if (n == -1) return -1;
+		if (n == 0) break;
+		left -= n;
+	}
+	char buf[65536];
+	while (1) {	// whatever is left, until EOF.
+		ssize_t n = read(in, buf, sizeof buf);
+		if (n == -1 && errno == EINTR) continue;
+		if (n == -1) {
+			*bad = pathfro;
+			return -1;
+		}
+		if (n == 0) break;
+		char *cp = buf;
+		while (n > 0) {
+			ssize_t w = write(out, cp, n);
+			if (w == -1 && errno == EINTR) continue;
+			if (w == -1) return -1;
+			cp += w;
+			n -= w;
+		}
+	}
+	return 0;
+} // copyfds()
+
+static int
+docopy(const char *pathfro, const char *pathto, const char **bad)
+{/* The work of copyfile() without the exit. Returns 0, or -1 with errno
+  * set and *bad the path to blame, having closed what it opened.
+*/
+	*bad = pathfro;
+	int in = open(pathfro, O_RDONLY | O_CLOEXEC);
+	if (in == -1) return -1;
+	*bad = pathto;
+	int out = open(pathto, O_WRONLY | O_CREAT | O_CLOEXEC, 0666);
+	if (out == -1) {
+		int err = errno;
+		close(in);
+		errno = err;
+		return -1;
+	}
+	int ret = 0;
+	struct stat sbin, sbout;
+	if (fstat(in, &sbin) == -1 || fstat(out, &sbout) == -1) {
+		*bad = pathfro;
+		ret = -1;
+	} else if (sbin.st_dev == sbout.st_dev && sbin.st_ino == sbout.st_ino) {
+		;	// copy onto itself, truncating would lose it.
+	} else if (ftruncate(out, 0) == -1) {
+		ret = -1;
+	} else {	// st_size is 0 for /proc files etc, copied to EOF.
+		ret = copyfds(in, out, sbin.st_size, pathfro, pathto, bad);
+	}
+	int err = errno;
+	close(in);
+	if (close(out) == -1 && ret == 0) {
+		err = errno;
+		*bad = pathto;
+		ret = -1;
+	}
+	fs_invalidate(pathto);
+	errno = err;
+	return ret;
+} // docopy()
+
 void
 copyfile(const char *pathfro, const char *pathto)
-{/* Does a file copy in user space. */
-	mdata *fd = readfile(pathfro, 1, 0);
-	writefile(pathto, fd->fro, fd->to, "w");
-	free_mdata(fd);
+{/* Copy pathfro to pathto, leaving as much of the work as possible to
+  * the kernel. In order it tries a FICLONE reflink, which shares the
+  * data blocks on btrfs or XFS, then copy_file_range(), then sendfile(),
+  * and last a read()/write() loop through a fixed buffer. Each method
+  * carries on from where the one before it stopped. The whole file is
+  * never held in memory.
+*/
+	const char *bad;
+	if (docopy(pathfro, pathto, &bad) == -1) {
+		perror(bad);
+		exit(EXIT_FAILURE);
+	}
 } // copyfile()
 
 void
@@ -277,42 +600,444 @@ dolink(const char *fr, const char *to)
 		perror(fr);	// don't know what caused the snafu
 		exit(EXIT_FAILURE);
 	}
+	fs_invalidate(to);
+	fs_invalidate(fr);	// its link count changed.
 } // dolink()
 
+typedef struct fopbatch {	/* shared state of a fileops_run(). */
+	fileop *ops;
+	size_t n;
+	size_t next;	// the next op to be taken.
+} fopbatch;
+
+static void
+fopdo(fileop *op)
+{/* Do one op of fileops_run(), recording how it went in op. */
+	op->err = 0;
+	op->errpath = NULL;
+	if (op->op == FOP_LINK) {
+		if (link(op->from, op->to) == -1) {
+			op->err = errno;
+			op->errpath = op->to;
+			return;
+		}
+		fs_invalidate(op->to);
+		fs_invalidate(op->from);	// its link count changed.
+	} else if (docopy(op->from, op->to, &op->errpath) == -1) {
+		op->err = errno;
+	}
+} // fopdo()
+
+static void
+*fopwork(void *arg)
+{/* Thread body of fileops_run(), takes ops until none are left. */
+	fopbatch *b = arg;
+	while (1) {
+		size_t i = __atomic_fetch_add(&b->next, 1, __ATOMIC_RELAXED);
+		if (i >= b->n) break;
+		fopdo(&b->ops[i]);
+	}
+	return NULL;
+} // fopwork()
+
+#ifdef FOP_RING
+/* The io_uring engine of fileops_run(). Every op is a chain of ring
+ * requests, each queued when the one before it completes: LINKAT for a
+ * link, and for a copy OPENAT of the source then of the destination, a
+ * STATX of both, SPLICE through a pipe until EOF, and CLOSE of both.
+ * Up to FOP_RINGOPS ops are in flight at once, so the ring always has
+ * room for their two requests each. The ring is driven with the raw
+ * io_uring_setup() and io_uring_enter() syscalls.
+ * */
+#define FR_LINK	0	// the kinds of request, the low bits of user_data.
+#define FR_OPENIN	1
+#define FR_OPENOUT	2
+#define FR_STATIN	3
+#define FR_STATOUT	4
+#define FR_SPLICEIN	5
+#define FR_SPLICEOUT	6
+#define FR_CLOSEIN	7
+#define FR_CLOSEOUT	8
+
+typedef struct fopring {	/* an io_uring set up by fopring_init(). */
+	int fd;
+	unsigned *sqtail, *sqmask, *sqarray;
+	unsigned *cqhead, *cqtail, *cqmask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *rings;	// the sq and cq rings, in one mapping.
+	size_t ringslen;
+	unsigned tosubmit;	// sqes queued since the last io_uring_enter().
+} fopring;
+
+typedef struct fopstate {	/* how far the ring has got with one op. */
+	int in, out;	// fds of a copy, -1 until open.
+	int pipe[2];
+	int pending;	// its requests not yet completed.
+	size_t inpipe;	// bytes spliced into pipe and not yet out of it.
+	struct statx sx[2];	// of in and out.
+} fopstate;
+
+static int fopringok;	// 1 if the kernel's ring does all the ops.
+static pthread_once_t fopringonce = PTHREAD_ONCE_INIT;
+
+static void
+fopring_free(fopring *r)
+{/* Undo fopring_init(). */
+	if (r->sqes) munmap(r->sqes, (*r->sqmask + 1) * sizeof(struct io_uring_sqe));
+	if (r->rings) munmap(r->rings, r->ringslen);
+	close(r->fd);
+} // fopring_free()
+
+static int
+fopring_init(fopring *r, unsigned entries)
+{/* Set up r with room for entries requests. Returns 0, or -1 if the
+  * kernel will not give us a ring.
+*/
+	struct io_uring_params p;
+	memset(&p, 0, sizeof p);
+	memset(r, 0, sizeof *r);
+	r->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd == -1) return -1;
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {	// before Linux 5.4.
+		close(r->fd);
+		return -1;
+	}
+	r->ringslen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	size_t cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (cqlen > r->ringslen) r->ringslen = cqlen;
+	char *rings = mmap(NULL, r->ringslen, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (rings == MAP_FAILED) {
+		close(r->fd);
+		return -1;
+	}
+	r->rings = rings;
+	r->sqtail = (unsigned *)(rings + p.sq_off.tail);
+	r->sqmask = (unsigned *)(rings + p.sq_off.ring_mask);
+	r->sqarray = (unsigned *)(rings + p.sq_off.array);
+	r->cqhead = (unsigned *)(rings + p.cq_off.head);
+	r->cqtail = (unsigned *)(rings + p.cq_off.tail);
+	r->cqmask = (unsigned *)(rings + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(rings + p.cq_off.cqes);
+	r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+				PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd,
+				IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED) {
+		r->sqes = NULL;
+		fopring_free(r);
+		return -1;
+	}
+	return 0;
+} // fopring_init()
+
+static void
+fopring_probe(void)
+{/* Set fopringok if a ring can be had that knows every op we use. */
+	static const int need[] = { IORING_OP_OPENAT, IORING_OP_STATX,
+			IORING_OP_SPLICE, IORING_OP_CLOSE, IORING_OP_LINKAT };
+	fopring r;
+	if (fopring_init(&r, 2) == -1) return;
+	size_t len = sizeof(struct io_uring_probe)
+				+ IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *pr = xcalloc(1, len);
+	if (syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_PROBE, pr,
+				IORING_OP_LAST) == 0) {
+		size_t i;
+		fopringok = 1;
+		for (i = 0; i < sizeof need / sizeof need[0]; i++) {
+			if (need[i] > pr->last_op
+					|| !(pr->ops[need[i]].flags & IO_URING_OP_SUPPORTED))
+				fopringok = 0;
+		}
+	}
+	free(pr);
+	fopring_free(&r);
+} // fopring_probe()
+
+static struct io_uring_sqe
+*fopring_sqe(fopring *r, fopstate *st, int opcode, size_t i, int kind)
+{/* Queue a cleared request for op i, to be submitted by the next
+  * io_uring_enter(). We are the only producer so the tail is ours.
+*/
+	unsigned tail = *r->sqtail;
+	unsigned idx = tail & *r->sqmask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof *sqe);
+	sqe->opcode = opcode;
+	sqe->user_data = (__u64)i << 4 | kind;
+	r->sqarray[idx] = idx;
+	__atomic_store_n(r->sqtail, tail + 1, __ATOMIC_RELEASE);
+	r->tosubmit++;
+	st->pending++;
+	return sqe;
+} // fopring_sqe()
+
+static void
+fopring_statx(fopring *r, fopstate *st, size_t i, int kind, int fd,
+				struct statx *sx)
+{/* Queue a STATX of the open fd. */
+	struct io_uring_sqe *sqe = fopring_sqe(r, st, IORING_OP_STATX, i, kind);
+	sqe->fd = fd;
+	sqe->addr = (__u64)(uintptr_t)"";
+	sqe->statx_flags = AT_EMPTY_PATH;
+	sqe->len = STATX_INO | STATX_SIZE;
+	sqe->off = (__u64)(uintptr_t)sx;
+} // fopring_statx()
+
+static void
+fopring_splice(fopring *r, fopstate *st, size_t i, int kind)
+{/* Queue a SPLICE of a copy, from in into the pipe for FR_SPLICEIN,
+  * or from the pipe out for FR_SPLICEOUT. Files use their offsets.
+*/
+	struct io_uring_sqe *sqe = fopring_sqe(r, st, IORING_OP_SPLICE, i, kind);
+	sqe->splice_off_in = (__u64)-1;
+	sqe->off = (__u64)-1;
+	if (kind == FR_SPLICEIN) {
+		sqe->splice_fd_in = st->in;
+		sqe->fd = st->pipe[1];
+		sqe->len = FOP_PIPESIZE;
+	} else {
+		sqe->splice_fd_in = st->pipe[0];
+		sqe->fd = st->out;
+		sqe->len = st->inpipe;
+	}
+} // fopring_splice()
+
+static void
+fopring_close(fopring *r, fopstate *st, size_t i)
+{/* Last stage of a copy, close what it opened. */
+	if (st->pipe[0] != -1) {
+		close(st->pipe[0]);
+		close(st->pipe[1]);
+		st->pipe[0] = st->pipe[1] = -1;
+	}
+	fopring_sqe(r, st, IORING_OP_CLOSE, i, FR_CLOSEIN)->fd = st->in;
+	if (st->out != -1)
+		fopring_sqe(r, st, IORING_OP_CLOSE, i, FR_CLOSEOUT)->fd = st->out;
+} // fopring_close()
+
+static void
+fopring_start(fopring *r, fileop *op, fopstate *st, size_t i)
+{/* Queue the first request of op i. */
+	struct io_uring_sqe *sqe;
+	op->err = 0;
+	op->errpath = NULL;
+	memset(st, 0, sizeof *st);
+	st->in = st->out = st->pipe[0] = st->pipe[1] = -1;
+	if (op->op == FOP_LINK) {
+		sqe = fopring_sqe(r, st, IORING_OP_LINKAT, i, FR_LINK);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (__u64)(uintptr_t)op->from;
+		sqe->len = AT_FDCWD;
+		sqe->addr2 = (__u64)(uintptr_t)op->to;
+	} else {
+		sqe = fopring_sqe(r, st, IORING_OP_OPENAT, i, FR_OPENIN);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (__u64)(uintptr_t)op->from;
+		sqe->open_flags = O_RDONLY | O_CLOEXEC;
+	}
+} // fopring_start()
+
+static int
+fopring_step(fopring *r, fileop *op, fopstate *st, size_t i, int kind,
+				int res)
+{/* Take the result res of a request of op i and queue what follows it,
+  * as fopdo() would have done it. Errors are recorded as docopy()
+  * records them. Returns 1 when the op is over.
+*/
+	struct io_uring_sqe *sqe;
+	st->pending--;
+	switch (kind) {
+	case FR_LINK:
+		if (res < 0) {
+			op->err = -res;
+			op->errpath = op->to;
+			return 1;
+		}
+		fs_invalidate(op->to);
+		fs_invalidate(op->from);	// its link count changed.
+		return 1;
+	case FR_OPENIN:
+		if (res < 0) {
+			op->err = -res;
+			op->errpath = op->from;
+			return 1;
+		}
+		st->in = res;
+		sqe = fopring_sqe(r, st, IORING_OP_OPENAT, i, FR_OPENOUT);
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (__u64)(uintptr_t)op->to;
+		sqe->open_flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+		sqe->len = 0666;
+		break;
+	case FR_OPENOUT:
+		if (res < 0) {
+			op->err = -res;
+			op->errpath = op->to;
+			fopring_close(r, st, i);
+			break;
+		}
+		st->out = res;
+		fopring_statx(r, st, i, FR_STATIN, st->in, &st->sx[0]);
+		fopring_statx(r, st, i, FR_STATOUT, st->out, &st->sx[1]);
+		break;
+	case FR_STATIN:
+	case FR_STATOUT:
+		if (res < 0 && !op->err) {
+			op->err = -res;
+			op->errpath = op->from;
+		}
+		if (st->pending) break;	// the other is still to come.
+		if (op->err || (st->sx[0].stx_ino == st->sx[1].stx_ino
+				&& st->sx[0].stx_dev_major == st->sx[1].stx_dev_major
+				&& st->sx[0].stx_dev_minor == st->sx[1].stx_dev_minor)) {
+			fopring_close(r, st, i);	// copy onto itself, leave it.
+			break;
+		}
+		if (ftruncate(st->out, 0) == -1 || pipe2(st->pipe, O_CLOEXEC) == -1) {
+			op->err = errno;
+			op->errpath = op->to;
+			fopring_close(r, st, i);
+			break;
+		}
+#ifdef FICLONE
+		if (st->sx[0].stx_size && ioctl(st->out, FICLONE, st->in) == 0) {
+			fopring_close(r, st, i);
+			break;
+		}
+#endif
+		fcntl(st->pipe[1], F_SETPIPE_SZ, FOP_PIPESIZE);	// may be refused.
+		fopring_splice(r, st, i, FR_SPLICEIN);
+		break;
+	case FR_SPLICEIN:
+		if (res < 0 && copyfallback(-res)) {	// no splice for this file.
+			if (copyfds(st->in, st->out, 0, op->from, op->to,
+						&op->errpath) == -1)
+				op->err = errno;
+		} else if (res < 0) {
+			op->err = -res;
+			op->errpath = op->from;
+		} else if (res > 0) {
+			st->inpipe = res;
+			fopring_splice(r, st, i, FR_SPLICEOUT);
+			break;
+		}
+		fopring_close(r, st, i);	// EOF or failed.
+		break;
+	case FR_SPLICEOUT:
+		if (res < 0) {
+			op->err = -res;
+			op->errpath = op->to;
+			fopring_close(r, st, i);
+			break;
+		}
+		st->inpipe -= res;
+		fopring_splice(r, st, i, st->inpipe ? FR_SPLICEOUT : FR_SPLICEIN);
+		break;
+	case FR_CLOSEIN:
+		break;
+	case FR_CLOSEOUT:
+		if (res < 0 && !op->err) {
+			op->err = -res;
+			op->errpath = op->to;
+		}
+		break;
+	}
+	if (st->pending) return 0;
+	if (st->out != -1) fs_invalidate(op->to);
+	return 1;
+} // fopring_step()
+
+static int
+fopring_run(fileop *ops, size_t n)
+{/* fileops_run() on an io_uring. Returns 0, or -1 having done nothing
+  * if the kernel has no ring that can do the ops.
+*/
+	pthread_once(&fopringonce, fopring_probe);
+	fopring r;
+	if (!fopringok || fopring_init(&r, 2 * FOP_RINGOPS) == -1) return -1;
+	fopstate *st = xmalloc(n * sizeof(fopstate));
+	size_t next = 0, active = 0, over = 0;
+	while (over < n) {
+		for (; active < FOP_RINGOPS && next < n; next++, active++)
+			fopring_start(&r, &ops[next], &st[next], next);
+		int ret = syscall(__NR_io_uring_enter, r.fd, r.tosubmit, 1,
+					IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret == -1 && errno == EINTR) continue;
+		if (ret == -1) {
+			perror("io_uring_enter");
+			exit(EXIT_FAILURE);
+		}
+		r.tosubmit -= ret;
+		unsigned head = *r.cqhead;
+		unsigned tail = __atomic_load_n(r.cqtail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			struct io_uring_cqe *cqe = &r.cqes[head & *r.cqmask];
+			size_t i = cqe->user_data >> 4;
+			if (fopring_step(&r, &ops[i], &st[i], i, cqe->user_data & 15,
+						cqe->res)) {
+				active--;
+				over++;
+			}
+		}
+		__atomic_store_n(r.cqhead, head, __ATOMIC_RELEASE);
+	}
+	free(st);
+	fopring_free(&r);
+	return 0;
+} // fopring_run()
+#endif
+
+size_t
+fileops_run(fileop *ops, size_t n, int nthreads)
+{/* Do the n ops concurrently. With nthreads 0 they are put through an
+  * io_uring when the kernel has one that can do them, else they are
+  * shared by up to nthreads threads, or FOP_THREADS if nthreads is 0.
+  * The ops must not depend on each other as their order is not kept.
+  * None is fatal, each gets err 0 or the errno of its failure, with
+  * errpath the path that it is about. Returns the count that failed.
+  * The threads spend their time waiting on the file system rather than
+  * the CPU, so there may be more than CPUs.
+*/
+	if (!n) return 0;
+	int ran = 0;
+#ifdef FOP_RING
+	if (nthreads == 0) ran = (fopring_run(ops, n) == 0);
+#endif
+	if (!ran) {
+		if (nthreads <= 0) nthreads = FOP_THREADS;
+		if ((size_t)nthreads > n) nthreads = n;
+		fopbatch b = { ops, n, 0 };
+		pthread_t *tids = xmalloc(nthreads * sizeof(pthread_t));
+		int i;
+		for (i = 1; i < nthreads; i++) {
+			if (pthread_create(&tids[i], NULL, fopwork, &b)) {
+				fputs("Could not create thread.\n", stderr);
+				exit(EXIT_FAILURE);
+			}
+		}
+		fopwork(&b);	// this thread works too.
+		for (i = 1; i < nthreads; i++) pthread_join(tids[i], NULL);
+		free(tids);
+	}
+	size_t j, failed = 0;
+	for (j = 0; j < n; j++) if (ops[j].err) failed++;
+	return failed;
+} // fileops_run()
+
 char
 *cfg_getparameter(char *prn, char *fn, const char *param)
-{ /* Return the string that param points to. */
-	mdata *md = getconfigfile(prn, fn);
-  // get rid of comment data
-  char *cp = md->fro;
-  cp = memchr(cp, '#', md->to - cp);
-  char *c;
-  while (cp) {
-    c = cp;
-    while (*c != '\n') {
-      *c = ' ';
-      c++;
-    }
-    cp = memchr(c, '#', md->to - c);
-  }
-	memlinestostr(md);
-	char *p = memmem(md->fro, md->to - md->fro, param, strlen(param));
-	if (!p) {
+{ /* Return a copy of the string that param points to. */
+	char path[PATH_MAX];
+	sprintf(path, "%s/.config/%s/%s", getenv("HOME"), prn, fn);
+	cfgstore *cs = cfg_load(path);
+	const char *val = cfg_get(cs, param);
+	if (!val) {
 		fprintf(stderr, "No such parameter: %s\n", param);
-		free_mdata(md);
 		exit(EXIT_FAILURE);
 	}
-	char *eq = strchr(p, '=');
-	if (!eq) {
-		fprintf(stderr, "Malformed parameter line: %s\n", p);
-		free_mdata(md);
-		exit(EXIT_FAILURE);
-	}
-	eq++;	// get past '='
-	trimspace(eq);
-	char *ret = xstrdup(eq);
-	free_mdata(md);
-	return ret;
+	return xstrdup(val);
 } // cfg_getparameter()
 
 void
@@ -323,6 +1048,7 @@ dounlink(const char *p)
 		perror(p);
 		exit(EXIT_FAILURE);
 	}
+	fs_invalidate(p);
 } // dounlink()
 
 mdata
@@ -335,3 +1061,326 @@ mdata
   stripcomment(md, "#", "\n", 0); // do not lop ending newline.
   return md;
 } // initconfigread()
+
+/* Config files are cached for the life of the process, keyed by path
+ * and validated by device, inode, mtime and size. A store that is
+ * superseded because its file changed is retired rather than freed, so
+ * pointers callers got from it stay valid until cfg_flush(). The lists
+ * are guarded by cfglock so threads may share the cache.
+ * */
+typedef struct cfgcache {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	off_t size;
+	cfgstore *cs;
+	struct cfgcache *next;
+} cfgcache;
+
+static cfgcache *cfgcached;	// live entries.
+static cfgcache *cfgretired;	// superseded entries, freed by cfg_flush().
+static pthread_mutex_t cfglock = PTHREAD_MUTEX_INITIALIZER;
+
+cfgstore
+*cfg_load(const char *path)
+{ /* Return the parsed config file at path, see cfg_parse(). It is read
+   * and parsed only if it is not cached or has changed since, checking
+   * that costs one fstatat(). The store belongs to the cache, do not
+   * free it.
+  */
+  struct stat sb;
+  if (fstatat(AT_FDCWD, path, &sb, 0) == -1) {
+    perror(path);
+    exit(EXIT_FAILURE);
+  }
+  pthread_mutex_lock(&cfglock);
+  cfgcache **epp = &cfgcached;
+  for (; *epp; epp = &(*epp)->next) {
+    if (strcmp((*epp)->path, path) == 0) break;
+  }
+  cfgcache *ep = *epp;
+  if (ep) {
+    if (ep->dev == sb.st_dev && ep->ino == sb.st_ino
+        && ep->size == sb.st_size
+        && ep->mtime.tv_sec == sb.st_mtim.tv_sec
+        && ep->mtime.tv_nsec == sb.st_mtim.tv_nsec) {
+      pthread_mutex_unlock(&cfglock);
+      return ep->cs;
+    }
+    *epp = ep->next;  // stale, retire it.
+    ep->next = cfgretired;
+    cfgretired = ep;
+  }
+  ep = xmalloc(sizeof(cfgcache));
+  ep->path = xstrdup(path);
+  ep->dev = sb.st_dev;
+  ep->ino = sb.st_ino;
+  ep->mtime = sb.st_mtim;
+  ep->size = sb.st_size;
+  mdata *md = readfile(path, 1, 0);
+  ep->cs = cfg_parse(md);
+  free_mdata(md);
+  ep->next = cfgcached;
+  cfgcached = ep;
+  pthread_mutex_unlock(&cfglock);
+  return ep->cs;
+} // cfg_load()
+
+void
+cfg_flush(void)
+{ /* Empty the config cache, invalidating every store it handed out. */
+  pthread_mutex_lock(&cfglock);
+  cfgcache *lists[2] = { cfgcached, cfgretired };
+  int i;
+  for (i = 0; i < 2; i++) {
+    cfgcache *ep = lists[i];
+    while (ep) {
+      cfgcache *next = ep->next;
+      free_cfgstore(ep->cs);
+      free(ep->path);
+      free(ep);
+      ep = next;
+    }
+  }
+  cfgcached = cfgretired = NULL;
+  pthread_mutex_unlock(&cfglock);
+} // cfg_flush()
+
+recreader
+*rr_open(const char *path, int delim, size_t bufsize)
+{ /* Open path, which may be "-" for stdin, to be read one record at a
+   * time by rr_next(). Records end at delim, which may be '\n' for lines
+   * or '\0' for lists such as find -print0 makes. The file is read
+   * through one buffer of bufsize bytes, 64 KiB if 0, so memory use does
+   * not depend on the size of the file. The buffer only grows if a
+   * single record will not fit in it.
+  */
+  recreader *rr = xmalloc(sizeof(recreader));
+  if (strcmp(path, "-") == 0) {
+    rr->fd = STDIN_FILENO;
+  } else {
+    rr->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (rr->fd == -1) {
+      perror(path);
+      exit(EXIT_FAILURE);
+    }
+    posix_fadvise(rr->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  }
+  rr->delim = delim;
+  rr->path = xstrdup(path);
+  rr->size = (bufsize < 64) ? 65536 : bufsize;
+  rr->buf = xmalloc(rr->size);
+  rr->start = rr->scan = rr->end = 0;
+  rr->eof = 0;
+  return rr;
+} // rr_open()
+
+char
+*rr_next(recreader *rr, size_t *len)
+{ /* Return the next record with its delimiter replaced by '\0', or NULL
+   * at the end of the file. A last record with no delimiter is returned
+   * too. If len is not NULL the record length is put there, which
+   * counts any embedded '\0' when delim is not '\0'. The record is in
+   * the reader's buffer and is only valid until the next call.
+  */
+  while (1) {
+    char *dp = memchr(rr->buf + rr->scan, rr->delim, rr->end - rr->scan);
+    char *rec = rr->buf + rr->start;
+    if (dp || (rr->eof && rr->start < rr->end)) {
+      if (!dp) dp = rr->buf + rr->end;  // unterminated last record.
+      *dp = 0;
+      if (len) *len = dp - rec;
+      rr->start = rr->scan = (dp - rr->buf) + 1;
+      if (rr->start > rr->end) rr->start = rr->scan = rr->end;
+      return rec;
+    }
+    if (rr->eof) return (char *)NULL;
+    rr->scan = rr->end;
+    if (rr->start) {  // move the partial record to the front.
+      memmove(rr->buf, rec, rr->end - rr->start);
+      rr->end -= rr->start;
+      rr->scan -= rr->start;
+      rr->start = 0;
+    }
+    if (rr->end == rr->size - 1) {  // one record fills it, grow.
+      char *p = realloc(rr->buf, rr->size * 2);
+      if (!p) {
+        fputs("Out of memory.\n", stderr);
+        exit(EXIT_FAILURE);
+      }
+      rr->buf = p;
+      rr->size *= 2;
+    }
+    ssize_t n = read(rr->fd, rr->buf + rr->end, rr->size - 1 - rr->end);
+    if (n == -1 && errno == EINTR) continue;
+    if (n == -1) {
+      perror(rr->path);
+      exit(EXIT_FAILURE);
+    }
+    if (n == 0) rr->eof = 1;
+    rr->end += n;
+  } // while()
+} // rr_next()
+
+void
+rr_close(recreader *rr)
+{ /* Close the file and free rr. */
+  if (rr->fd != STDIN_FILENO) close(rr->fd);
+  vfree(rr->buf, rr->path, rr, NULL);
+} // rr_close()
+
+size_t
+foreachrecord(const char *path, int delim,
+				int (*fn)(char *rec, size_t len, void *arg), void *arg)
+{ /* Call fn for each record in path, see rr_open(), with arg passed on.
+   * Stops early if fn returns non-zero. Returns the number of records
+   * given to fn.
+  */
+  recreader *rr = rr_open(path, delim, 0);
+  size_t count = 0;
+  char *rec;
+  size_t len;
+  while ((rec = rr_next(rr, &len))) {
+    count++;
+    if (fn(rec, len, arg)) break;
+  }
+  rr_close(rr);
+  return count;
+} // foreachrecord()
+
+/* fs_stat() keeps the most recent results, failures included, in a
+ * small direct mapped table keyed by the path as given and the follow
+ * flag. Functions here that change the file system call fs_invalidate()
+ * for what they change. Changes made by other processes, or through
+ * another spelling of the same path, are not seen until then.
+ * */
+typedef struct fscached {
+	char *path;	// NULL if the slot is empty.
+	int flags;
+	int err;	// errno if the stat failed, else 0.
+	fsinfo fi;
+} fscached;
+
+static fscached fscache[FS_CACHESIZE];
+static pthread_mutex_t fslock = PTHREAD_MUTEX_INITIALIZER;
+
+static void
+fromstatx(const struct statx *sx, fsinfo *fi)
+{ /* Copy what fsinfo keeps out of sx. */
+	fi->mask = sx->stx_mask;
+	fi->mode = sx->stx_mode;
+	fi->size = sx->stx_size;
+	fi->ino = sx->stx_ino;
+	fi->dev = makedev(sx->stx_dev_major, sx->stx_dev_minor);
+	fi->mtime.tv_sec = sx->stx_mtime.tv_sec;
+	fi->mtime.tv_nsec = sx->stx_mtime.tv_nsec;
+} // fromstatx()
+
+static int
+dostatx(int dirfd, const char *path, int atflags, unsigned mask,
+		fsinfo *fi)
+{ /* One statx() for mask, or fstatat() where statx() is missing.
+   * Returns 0 or -1 with errno set.
+  */
+	struct statx sx;
+	if (statx(dirfd, path, atflags | AT_STATX_SYNC_AS_STAT, mask, &sx)
+			== 0) {
+		fromstatx(&sx, fi);
+		return 0;
+	}
+	if (errno != ENOSYS) return -1;
+	struct stat sb;
+	if (fstatat(dirfd, path, &sb, atflags) == -1) return -1;
+	fi->mask = STATX_BASIC_STATS;
+	fi->mode = sb.st_mode;
+	fi->size = sb.st_size;
+	fi->ino = sb.st_ino;
+	fi->dev = sb.st_dev;
+	fi->mtime = sb.st_mtim;
+	return 0;
+} // dostatx()
+
+static size_t
+fsslot(const char *path, int flags)
+{ /* The fscache slot for path, FNV-1a. */
+	unsigned h = 2166136261u ^ (unsigned)flags;
+	const unsigned char *cp;
+	for (cp = (const unsigned char *)path; *cp; cp++) {
+		h ^= *cp;
+		h *= 16777619u;
+	}
+	return h % FS_CACHESIZE;
+} // fsslot()
+
+int
+fs_stat(const char *path, int flags, unsigned mask, fsinfo *fi)
+{ /* stat() or with FS_NOFOLLOW lstat() path, asking the kernel only for
+   * the STATX_* fields in mask, with the result in fi. The result is
+   * cached, see above. Returns 0, or -1 with errno set.
+  */
+	size_t slot = fsslot(path, flags);
+	fscached *ep = &fscache[slot];
+	pthread_mutex_lock(&fslock);
+	if (ep->path && ep->flags == flags && strcmp(ep->path, path) == 0
+			&& (ep->err || (ep->fi.mask & mask) == mask)) {
+		int err = ep->err;
+		if (!err) *fi = ep->fi;
+		pthread_mutex_unlock(&fslock);
+		if (err) {
+			errno = err;
+			return -1;
+		}
+		return 0;
+	}
+	pthread_mutex_unlock(&fslock);
+	int atflags = (flags & FS_NOFOLLOW) ? AT_SYMLINK_NOFOLLOW : 0;
+	int res = dostatx(AT_FDCWD, path, atflags, mask | STATX_TYPE, fi);
+	int err = (res == -1) ? errno : 0;
+	pthread_mutex_lock(&fslock);
+	if (!ep->path || strcmp(ep->path, path) != 0) {
+		free(ep->path);
+		ep->path = xstrdup(path);
+	}
+	ep->flags = flags;
+	ep->err = err;
+	if (!err) ep->fi = *fi;
+	pthread_mutex_unlock(&fslock);
+	if (err) errno = err;
+	return res;
+} // fs_stat()
+
+int
+fs_fstat(int fd, unsigned mask, fsinfo *fi)
+{ /* As fs_stat() for an open fd, which is never cached. */
+	return dostatx(fd, "", AT_EMPTY_PATH, mask | STATX_TYPE, fi);
+} // fs_fstat()
+
+int
+fs_statat(int dirfd, const char *name, int flags, unsigned mask,
+			fsinfo *fi)
+{ /* As fs_stat() for name relative to the dir open at dirfd, which is
+   * never cached. For walkers that hold the dir's fd anyway.
+  */
+	int atflags = (flags & FS_NOFOLLOW) ? AT_SYMLINK_NOFOLLOW : 0;
+	return dostatx(dirfd, name, atflags, mask | STATX_TYPE, fi);
+} // fs_statat()
+
+void
+fs_invalidate(const char *path)
+{ /* Forget what fs_stat() knows of path, or of everything if NULL. */
+	pthread_mutex_lock(&fslock);
+	size_t i;
+	for (i = 0; i < FS_CACHESIZE; i++) {
+		fscached *ep = &fscache[i];
+		if (!ep->path) continue;
+		if (path) {	// it can only be in the slots for its two flags.
+			if (i != fsslot(path, 0) && i != fsslot(path, FS_NOFOLLOW))
+				continue;
+			if (strcmp(ep->path, path) != 0) continue;
+		}
+		free(ep->path);
+		ep->path = NULL;
+	}
+	pthread_mutex_unlock(&fslock);
+} // fs_invalidate()
@@ -29,6 +29,11 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
 //#include <sys/wait.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -42,9 +47,51 @@
 #include <linux/limits.h>
 #include <libgen.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "str.h"
 
+#define WF_APPEND	1	// writefilev() appends to an existing file.
+#define WF_ATOMIC	2	// writefilev() replaces the file in one step.
+
+typedef struct fsinfo {	/* the stat fields in use, see fs_stat(). */
+	unsigned mask;	// STATX_* fields that are valid.
+	mode_t mode;
+	off_t size;
+	ino_t ino;
+	dev_t dev;
+	struct timespec mtime;
+} fsinfo;
+
+#define FS_NOFOLLOW	1	// fs_stat() is to act as lstat().
+#define FS_CACHESIZE	128	// entries in the fs_stat() cache.
+
+#define FOP_LINK	1	// fileop kinds, link() from to to.
+#define FOP_COPY	2	// copyfile() from to to.
+#define FOP_THREADS	16	// default threads of fileops_run().
+#define FOP_RINGOPS	64	// ops in flight on its io_uring.
+#define FOP_PIPESIZE	(1 << 20)	// bytes a ring copy splices at a time.
+
+typedef struct fileop {	/* one job for fileops_run(). */
+	int op;	// FOP_LINK or FOP_COPY.
+	const char *from;
+	const char *to;
+	int err;	// set by the run, 0 or the errno of the failure.
+	const char *errpath;	// the path err is about.
+} fileop;
+
+typedef struct recreader {	/* streaming record reader, see rr_open(). */
+	int fd;
+	int delim;	// record separator, may be '\0'.
+	char *path;	// for error messages.
+	char *buf;
+	size_t size;	// bytes at buf, one is kept spare for a '\0'.
+	size_t start;	// first byte not yet handed out.
+	size_t scan;	// no delim in [start, scan).
+	size_t end;	// end of the data read so far.
+	int eof;
+} recreader;
+
 void
 writestrarray(char **list);
 
@@ -72,6 +119,9 @@ str2file(const char *fn, const char *s, const char *mode);
 mdata
 *readfile(const char *fn, int fatal, size_t extra);
 
+mdata
+*readfile_map(const char *path, int fatal, int writable);
+
 FILE
 *dofopen(const char *fn, const char *opnmode);
 
@@ -81,6 +131,13 @@ dofclose(FILE *fp);
 void
 writefile(const char *fn, char *fro, char *to, const char *opnmode);
 
+void
+writefilev(const char *path, const struct iovec *iov, size_t count,
+			int flags);
+
+void
+writemdata(const char *path, mdata *md, int flags);
+
 void
 strblocktolines(char *fro, char *to);
 
@@ -99,6 +156,9 @@ copyfile(const char *pathfro, const char *pathto);
 void
 dolink(const char *fro, const char *to);
 
+size_t
+fileops_run(fileop *ops, size_t n, int nthreads);
+
 char
 *cfg_getparameter(char *prn, char *fn, const char *param);
 
@@ -108,4 +168,36 @@ dounlink(const char *p);
 mdata
 *initconfigread(const char *path);
 
+cfgstore
+*cfg_load(const char *path);
+
+void
+cfg_flush(void);
+
+int
+fs_stat(const char *path, int flags, unsigned mask, fsinfo *fi);
+
+int
+fs_fstat(int fd, unsigned mask, fsinfo *fi);
+
+int
+fs_statat(int dirfd, const char *name, int flags, unsigned mask,
+			fsinfo *fi);
+
+void
+fs_invalidate(const char *path);
+
+recreader
+*rr_open(const char *path, int delim, size_t bufsize);
+
+char
+*rr_next(recreader *rr, size_t *len);
+
+void
+rr_close(recreader *rr);
+
+size_t
+foreachrecord(const char *path, int delim,
+				int (*fn)(char *rec, size_t len, void *arg), void *arg);
+
 #endif
@@ -58,26 +58,45 @@ void firstrun(char *progname, char **names)
 	char pathfr[PATH_MAX];
 	sprintf(pathfr, "/usr/local/share/%s/", progname);
 	size_t frlen = strlen(pathfr);
-	// File copy
-	int i;
-	for (i = 0; names[i]; i++) {
+	// File copy, all at once.
+	size_t i, n;
+	for (n = 0; names[n]; n++);
+	fileop *ops = xmalloc((n + 1) * sizeof(fileop));
+	arena *ap = arena_new(4 * PATH_MAX);
+	for (i = 0; i < n; i++) {
 		strcpy(pathfr + frlen, names[i]);
 		strcpy(pathto + tolen, names[i]);
-		copyfile(pathfr, pathto);
+		ops[i].op = FOP_COPY;
+		ops[i].from = arena_strdup(ap, pathfr);
+		ops[i].to = arena_strdup(ap, pathto);
 	}
+	fileops_run(ops, n, 0);
+	for (i = 0; i < n; i++) {
+		if (ops[i].err) {
+			fprintf(stderr, "%s: %s\n", ops[i].errpath, strerror(ops[i].err));
+			exit(EXIT_FAILURE);
+		}
+	}
+	arena_free(ap);
+	free(ops);
 } // firstrun()
 
-void rmconfigs(char *cfgdir)
-{/* This is run to ensure that there are no unused config files left. */
-	mdata *md = init_mdata();
-	rd_data *rd = init_recursedir(NULL, 2*PATH_MAX, DT_REG, 0);
-	int res = recursedir(cfgdir, md, rd);
-	if (res) {
-		char *cp = md->fro;
-		while (cp < md->to) { // redundant testing
-			if (exists_file(cp)) dounlink(cp);
-			cp += strlen(cp) + 1;
-		}
+static int rmconfig(const rd_entry *ent, void *arg)
+{/* rd_walk() visitor for rmconfigs(), unlinks each regular file. */
+	(void)arg;
+	if (unlinkat(ent->dirfd, ent->name, 0) == -1) {
+		perror(ent->path);
+		exit(EXIT_FAILURE);
 	}
-	free_recursedir(rd, md);
+	fs_invalidate(ent->path);
+	return RD_CONTINUE;
+} // rmconfig()
+
+void rmconfigs(char *cfgdir)
+{/* This is run to ensure that there are no unused config files left.
+  * Files are unlinked as the walk finds them, no list is made.
+*/
+	rd_data *rd = init_recursedir(NULL, 0, DT_REG, 0);
+	rd_walk(cfgdir, rd, rmconfig, NULL);
+	free_recursedir(rd, NULL);
 } // rmconfigs()
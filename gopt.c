@@ -34,13 +34,9 @@ options_t process_options(int argc, char **argv)
   opts.options_list   = NULL;
 
   int c;
-  const int max = PATH_MAX;
-  char joinbuffer[PATH_MAX];    // collects list of extra software.
-  joinbuffer[0] = 0;
-  char databuffer[PATH_MAX];    // collects list of other data.
-  databuffer[0] = 0;
-  char optionsbuffer[PATH_MAX]; // collects list of options codes.
-  optionsbuffer[0] = 0;
+  strbld *joinbuffer = strbld_new(0);     // collects list of extra software.
+  strbld *databuffer = strbld_new(0);     // collects list of other data.
+  strbld *optionsbuffer = strbld_new(0);  // collects list of options codes.
 
   while(1) {
     int this_option_optind = optind ? optind : 1;
@@ -72,13 +68,13 @@ options_t process_options(int argc, char **argv)
       opts.runvsn = 1;
     break;
     case 'd':  // output software dependencies for Makefile.am
-      strjoin(joinbuffer, ' ',optarg, max);
+      strbld_join(joinbuffer, ' ', optarg);
     break;
     case 'n':  // output options descriptor strings.
-      strjoin(optionsbuffer, ' ', optarg, max);
+      strbld_join(optionsbuffer, ' ', optarg);
     break;
     case 'x':  // other data for Makefile.am
-      strjoin(databuffer, ' ',optarg, max);
+      strbld_join(databuffer, ' ', optarg);
     break;
     case ':':
       fprintf(stderr, "Option %s requires an argument\n",
@@ -92,15 +88,15 @@ options_t process_options(int argc, char **argv)
     break;
     } // switch()
   } // while()
-  if (strlen(joinbuffer)) {
-    opts.software_deps = xstrdup(joinbuffer);
-  }
-  if (strlen(databuffer)) {
-    opts.extra_data = xstrdup(databuffer);
-  }
-  if (strlen(optionsbuffer)) {
-    opts.options_list = xstrdup(optionsbuffer);    
-  }
+  if (joinbuffer->len) {
+    opts.software_deps = strbld_detach(joinbuffer);
+  } else free_strbld(joinbuffer);
+  if (databuffer->len) {
+    opts.extra_data = strbld_detach(databuffer);
+  } else free_strbld(databuffer);
+  if (optionsbuffer->len) {
+    opts.options_list = strbld_detach(optionsbuffer);
+  } else free_strbld(optionsbuffer);
   return opts;
 } // process_options()
 
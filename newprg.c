@@ -52,14 +52,16 @@ static void progidfree(progid *pi);
 typedef struct prgvar_t { /* carries all vars needed to generate the
                               new program output.
                           */
-  char **optsout;   // list of all the options in the new program.
+  struct strlist *optsout;   // all the options in the new program.
   progid *pi;       // names made from the input project name.
-  char **libswlist; // source library software list.
-  char **extras;    // extradist files, eg config data files etc.
+  struct strlist *libswlist; // source library software list.
+  struct strlist *extras;    // extradist files, eg config data etc.
   char *newdir;     // full path to the dir of the new program
   char *linksdir;   // full path to the dir of the lib s/w to link in.
   char *stubsdir;   // full path to the dir of the lib s/w to copy in.
   char *templates;  // full path to the dir of the templates files.
+  struct arena *ap; // the option, config and defaults strings live here.
+  struct cfgstore *cfg; // the parsed newprg.cfg
   /* The search order for named dependency files is, linksdir,
    * stubsdir, then templates.
    * */
@@ -95,44 +97,54 @@ static void dohelp(int forced);
 static void dovsn(void);
 static void is_this_first_run(void);
 static prgvar_t *action_options(options_t *optp);
-static char **getlibsoftwarenames(const char *path, char *nameslist);
-static char *expand_extensions(const char *list);
-static char *read_defaults(const char *path);
+static strlist *getlibsoftwarenames(arena *ap, const char *path,
+                                    char *nameslist);
+static char *expand_extensions(arena *ap, const char *list);
+static char *read_defaults(arena *ap, const char *path);
+static char *gathernames(arena *ap, const char *path,
+                          const char *nameslist);
 static prgvar_t *prog_args(prgvar_t *pv, options_t *optp, char **argv);
-static char **getextras(const char *path, char *nameslist);
-static char **getoptionslist(const char *path, char *nameslist);
-static prgvar_t *makepaths(char **configs, prgvar_t *pv);
-static progid *makeprogname(const char *);
+static strlist *getextras(arena *ap, const char *path, char *nameslist);
+static strlist *getoptionslist(arena *ap, const char *path,
+                              char *nameslist);
+static prgvar_t *makepaths(prgvar_t *pv);
+static progid *makeprogname(const char *, cfgstore *cfg);
 static void maketargetdir(prgvar_t *pv);
 static newopt_t **makenewoptionslist(prgvar_t *pv); // the array
-static newopt_t *makenewoption(char *optsdescriptor);  // the struct
+static newopt_t *makenewoption(arena *ap, char *optsdescriptor);
 static int validateoptsdescriptor(char *optsdescriptor);
 static int validshortname(char *buf);
 static int validlongname(char *buf);
 static int validpurpose(char *buf);
 static int validCtype(char *buf);
-static char *getdflt(char *purpose);
+static char *getdflt_r(arena *ap, const char *ctype);
 static void maketargetoptions(prgvar_t *pv, newopt_t **nopl);
 static void maketoheader(prgvar_t *pv, newopt_t **nopl);
 static void maketoCfile(prgvar_t *pv, newopt_t **nopl);
 static mdata *gettargetfile(prgvar_t *pv, const char *fn);
-static void setfileownertext(prgvar_t *pv, mdata *md);
-static char *settargetfilename(prgvar_t *pv, const char *fn);
-static char *buildoptstring(newopt_t **nopl);
-static char *builddefaults(newopt_t **nopl);
-static char *buildlongopts(newopt_t **nopl);
-static char *buildcases(newopt_t **nopl);
+static mdata *rendertarget(prgvar_t *pv, const char *fn, const pair *tbl,
+                            size_t n);
+static void writetarget(prgvar_t *pv, const char *fn, const pair *tbl,
+                          size_t n);
+static char *fileownertext(prgvar_t *pv, char *buf);
+static char *settargetfilename_r(prgvar_t *pv, const char *fn, char *buf);
+static char *buildoptstring_r(newopt_t **nopl, strbld *sb);
+static char *builddefaults_r(newopt_t **nopl, strbld *sb);
+static char *buildlongopts_r(newopt_t **nopl, strbld *sb);
+static char *buildcases_r(newopt_t **nopl, strbld *sb);
 static char *getoptrval(const char *ctype, const char *purpose);
 static void placelibs(prgvar_t *pv);
+static int maybeindir(strlist *names, const char *name);
+static void placecopies(prgvar_t *pv, const char *fromdir, char **to,
+                          int *ilist, fileop *ops, arena *ap);
 static void makemain(prgvar_t *pv, newopt_t **nopl);
 static void ulstr(int, char *);
-static void generatepvstruct(mdata *md, newopt_t **nopl);
-static void genpvstructopt(mdata *md, newopt_t **nopl);
-static void genpvstructarg(mdata *md, newopt_t **nopl);
-static void genpvstructfreeopt(mdata *md, newopt_t **nopl);
-static void genpvstructfreearg(mdata *md, newopt_t **nopl);
+static void genpvstructopt(strbld *sb, newopt_t **nopl);
+static void genpvstructarg(strbld *sb, newopt_t **nopl);
+static void genpvstructfreeopt(strbld *sb, newopt_t **nopl);
+static void genpvstructfreearg(strbld *sb, newopt_t **nopl);
 static void fmtoutputctl(prgvar_t *pv);
-static void fmtoutput(mdata *md);
+static void fmtoutput(acmach *ac, mdata *md);
 
 
 
@@ -152,9 +164,11 @@ int main(int argc, char **argv)
   // data gathering
   options_t opt = process_options(argc, argv);
   prgvar_t *pv = action_options(&opt);
+  char cfgpath[PATH_MAX];
+  sprintf(cfgpath, "%s/.config/newprg/newprg.cfg", getenv("HOME"));
+  pv->cfg = cfg_load(cfgpath);
   pv = prog_args(pv, &opt, argv);
-  char **configs = loadconfigs("newprg");
-  pv = makepaths(configs, pv);
+  pv = makepaths(pv);
   maketargetdir(pv);  // generate the target dir.
   newopt_t **nopl = makenewoptionslist(pv);
   placelibs(pv);  // software source library code.
@@ -202,12 +216,12 @@ prgvar_t
   char *pname = argv[optind];
   optind++;
   if (argv[optind]) printerr("Extraneous input:", argv[optind], 1);
-  pv->pi = makeprogname(pname);  // variations on the project name.
+  pv->pi = makeprogname(pname, pv->cfg); // variations on project name.
   return pv;
 } // prog_args()
 
 progid
-*makeprogname(const char *pname)
+*makeprogname(const char *pname, cfgstore *cfg)
 {  /* Create and fill in the progid struct with the values needed in
    * Makefile.am, ->exe = name, ->src = name.c, ->man = name.1,
    * and ->thr = nam .
@@ -232,23 +246,23 @@ progid
   strcpy(name, lcname);
   ulstr('u', name);
   prid->mpt = xstrdup(name);  // manpage title
-  char ubuf[PATH_MAX];  // get the users name and config path.
-  strcpy(ubuf, getenv("HOME"));
-  strjoin(ubuf, '/', ".config/newprg/newprg.cfg", PATH_MAX);
-  mdata *md = initconfigread(ubuf);
-  prid->author = cfg_getparameter("newprg", "newprg.cfg", "author");
-  prid->email = cfg_getparameter("newprg", "newprg.cfg", "email");
+  const char *author = cfg_get(cfg, "author"); // get the users name.
+  const char *email = cfg_get(cfg, "email");
+  if (!author) printerr("No such parameter", "author", 1);
+  if (!email) printerr("No such parameter", "email", 1);
+  prid->author = xstrdup(author);
+  prid->email = xstrdup(email);
   return prid;
 } // makeprogname()
 
 prgvar_t
-*makepaths(char **configs, prgvar_t *pv)
+*makepaths(prgvar_t *pv)
 { /* make full paths to the new program dir, source library files to
   link into the new dir, and source lib files to be copied. */
   char buf[PATH_MAX];
   char *home = getenv("HOME");
   strcpy(buf, home);
-  char *cfg = getconfig(configs, "progdir");
+  const char *cfg = cfg_get(pv->cfg, "progdir");
   if (cfg) {
     strcpy(buf, home);
     strjoin(buf, '/', cfg, PATH_MAX);
@@ -261,15 +275,15 @@ prgvar_t
   strjoin(buf, '/', pv->pi->dir, PATH_MAX);
   pv->newdir = xstrdup(buf);
   strcpy(buf, docroot); // path to linked in s/w libs.
-  cfg = getconfig(configs, "compdir");
+  cfg = cfg_get(pv->cfg, "compdir");
   strjoin(buf, '/', cfg, PATH_MAX);
   pv->linksdir = xstrdup(buf);
   strcpy(buf, docroot); // path to copied s/w libs.
-  cfg = getconfig(configs, "stubdir");
+  cfg = cfg_get(pv->cfg, "stubdir");
   strjoin(buf, '/', cfg, PATH_MAX);
   pv->stubsdir = xstrdup(buf);
   strcpy(buf, docroot); // path to template files.
-  cfg = getconfig(configs, "templates");
+  cfg = cfg_get(pv->cfg, "templates");
   strjoin(buf, '/', cfg, PATH_MAX);
   pv->templates = xstrdup(buf);
   free(docroot);
@@ -292,22 +306,22 @@ newopt_t
 **makenewoptionslist(prgvar_t *pv)  // the array of structs
 { /* Using the array of chars describing each option as input, this
   returns any array of structs with all the expanded option data. */
-  int count = 0;
-  while (pv->optsout[count]) count++; // array is null terminated.
-  newopt_t **nopl = xmalloc((count+1) * sizeof(newopt_t *));
+  int count = pv->optsout->count;
+  newopt_t **nopl = arena_alloc(pv->ap, (count+1) * sizeof(newopt_t *));
   int i;
   for (i = 0; i < count; i++) {
-    nopl[i] = makenewoption(pv->optsout[i]);
+    nopl[i] = makenewoption(pv->ap, strlist_item(pv->optsout, i));
   }
+  nopl[count] = (newopt_t *)NULL;
   return nopl;
 } // makenewoptionslist()
  
 newopt_t
-*makenewoption(char *optsdescriptor) // the struct
-{ /* */
+*makenewoption(arena *ap, char *optsdescriptor) // the struct
+{ /* The struct and its strings are allocated from ap. */
   validateoptsdescriptor(optsdescriptor); // exits on error.
   //fprintf(stderr, "%s\n", optsdescriptor);
-  newopt_t *nop = xmalloc(sizeof(newopt_t));
+  newopt_t *nop = arena_alloc(ap, sizeof(newopt_t));
   char buf[PATH_MAX];
   char objbuf[NAME_MAX];
   strcpy(buf, optsdescriptor);  // protect the source.
@@ -316,52 +330,52 @@ newopt_t
   while (*comma != ',') comma++;
   *comma = 0;
   strcpy(objbuf, obj);
-  if (validshortname(objbuf)) nop->shortopt = xstrdup(objbuf);
+  if (validshortname(objbuf)) nop->shortopt = arena_strdup(ap, objbuf);
   obj = comma + 1;  // field # 2, long option name.
   while (*comma != ',') comma++;
   *comma = 0;
   strcpy(objbuf, obj);
-  if (validlongname(objbuf)) nop->longopt = xstrdup(objbuf);
+  if (validlongname(objbuf)) nop->longopt = arena_strdup(ap, objbuf);
   obj = comma + 1;  // field # 3, option variable name.
   while (*comma != ',') comma++;
   *comma = 0;
   strcpy(objbuf, obj);
-  if (strlen(objbuf)) nop->varname = xstrdup(objbuf);
+  if (strlen(objbuf)) nop->varname = arena_strdup(ap, objbuf);
     else nop->varname = "FIXME";
   obj = comma + 1;  // field # 4, ctype.
   while (*comma != ',') comma++;
   *comma = 0;
   strcpy(objbuf, obj);
-  if (validCtype(objbuf)) nop->ctype = xstrdup(objbuf);
+  if (validCtype(objbuf)) nop->ctype = arena_strdup(ap, objbuf);
   obj = comma + 1;  // field # 5, purpose.
   while (*comma != ',') comma++;
   *comma = 0;
   strcpy(objbuf, obj);
   if (strlen(objbuf)) {
-    if (validpurpose(objbuf)) nop->purpose = xstrdup(objbuf);
+    if (validpurpose(objbuf)) nop->purpose = arena_strdup(ap, objbuf);
   } else nop->purpose = (char *)NULL;
   obj = comma + 1;  // field # 6, dflt_val.
   while (*comma != ',') comma++;
   *comma = 0;
   strcpy(objbuf, obj);
-  if (strlen(objbuf)) nop->dflt_val = xstrdup(objbuf);
-    else nop->dflt_val = getdflt(nop->ctype);
+  if (strlen(objbuf)) nop->dflt_val = arena_strdup(ap, objbuf);
+    else nop->dflt_val = getdflt_r(ap, nop->ctype);
   obj = comma + 1;  // field # 7, max_val.
   while (*comma != ',') comma++;
   *comma = 0;
   strcpy(objbuf, obj);
-  if (strlen(objbuf)) nop->max_val = xstrdup(objbuf);
+  if (strlen(objbuf)) nop->max_val = arena_strdup(ap, objbuf);
     else nop->max_val = (char*)NULL;
   obj = comma + 1;  // field # 8, help_txt.
   while (*comma != ',') comma++;
   *comma = 0;
   strcpy(objbuf, obj);
-  if (strlen(objbuf)) nop->help_txt = xstrdup(objbuf);
-    else nop->help_txt = xstrdup("FIXME");
+  if (strlen(objbuf)) nop->help_txt = arena_strdup(ap, objbuf);
+    else nop->help_txt = arena_strdup(ap, "FIXME");
   obj = comma + 1;  // field # 9, runfunc.
   strcpy(objbuf, obj);
-  if (strlen(objbuf)) nop->runfunc = xstrdup(objbuf);
-    else nop->runfunc = xstrdup("FIXME");
+  if (strlen(objbuf)) nop->runfunc = arena_strdup(ap, objbuf);
+    else nop->runfunc = arena_strdup(ap, "FIXME");
   return nop;
 } // makenewoption()
 
@@ -466,62 +480,105 @@ int validCtype(char *buf)
 } // validCtype()
 
 char
-*getdflt(char *ctype)
-{ /* do a dictionary lookup to find the default zero value. */
+*getdflt_r(arena *ap, const char *ctype)
+{ /* do a dictionary lookup to find the default zero value, returned as
+   * a copy in ap.
+  */
   char *list[4] = { "int=0", "double=0.0", "char*=(char*)NULL", NULL};
-  static char buf[PATH_MAX];
   char *cp = dictionary(list, ctype);
   if (!cp) {
     fprintf(stderr, "Invalid option ctype: %s\n", ctype);
     exit(EXIT_FAILURE);
   }
-  strcpy(buf, cp);
-  return buf;
-} // getdflt()
+  return arena_strdup(ap, cp);
+} // getdflt_r()
 
 void placelibs(prgvar_t *pv)
 { /* Link source libraries (linksdir), copy the same as needed
    * (stubsdir), copy gopt.? ./templates from ./, or print warning
-   *  messages as needed.
+   *  messages as needed. Each pass is one batch for fileops_run(), so
+   *  the files of a pass are placed concurrently.
   */
-  int count = 0;
-  while (pv->libswlist[count]) count++;
+  if (!pv->libswlist) return;
+  size_t count = pv->libswlist->count;
   int *ilist = xmalloc(count * sizeof(int));
-  int i;
-  for (i = 0; i < count; i++) ilist[i] = 1;
-  char frbuf[PATH_MAX], tobuf[PATH_MAX];
+  char **to = xmalloc(count * sizeof(char *));
+  fileop *ops = xmalloc(count * sizeof(fileop));
+  arena *ap = arena_new(4 * PATH_MAX);
+  char buf[PATH_MAX];
+  size_t i;
   for (i = 0; i < count; i++) { // to be linked
-    sprintf(frbuf, "%s/%s", pv->linksdir, pv->libswlist[i]);
-    sprintf(tobuf, "%s/%s", pv->newdir, pv->libswlist[i]);
-    int res = link(frbuf, tobuf); // may not succeed
-    if (res == 0) ilist[i] = 0; // success.
+    sprintf(buf, "%s/%s", pv->newdir, strlist_item(pv->libswlist, i));
+    to[i] = arena_strdup(ap, buf);
+    sprintf(buf, "%s/%s", pv->linksdir, strlist_item(pv->libswlist, i));
+    ops[i].op = FOP_LINK;
+    ops[i].from = arena_strdup(ap, buf);
+    ops[i].to = to[i];
   }
-  for (i = 0; i < count; i++) { // to be copied
+  fileops_run(ops, count, 0);
+  for (i = 0; i < count; i++) ilist[i] = (ops[i].err != 0); // may fail
+  placecopies(pv, pv->stubsdir, to, ilist, ops, ap);
+  placecopies(pv, "./templates", to, ilist, ops, ap); // gopt.c|h
+  for (i = 0; i < count; i++) { // dependencies for the makefile.
     if (ilist[i]) {
-      sprintf(frbuf, "%s/%s", pv->stubsdir, pv->libswlist[i]);
-      sprintf(tobuf, "%s/%s", pv->newdir, pv->libswlist[i]);
-      if (exists_file(frbuf)) { // the file does not have to exist
-        copyfile(frbuf, tobuf);
-        ilist[i] = 0;
-      }
+      fprintf(stderr, "File: %s does not exist.\n", strlist_item(pv->libswlist, i));
     }
   } // for()
-  for (i = 0; i < count; i++) { // gopt.c|h from templates dir
-    if (ilist[i]) {
-      sprintf(frbuf, "%s/%s", "./templates", pv->libswlist[i]);
-      sprintf(tobuf, "%s/%s", pv->newdir, pv->libswlist[i]);
-      if (exists_file(frbuf)) { // the file does not have to exist
-        copyfile(frbuf, tobuf);
-        ilist[i] = 0;
-      }
-    }
+  arena_free(ap);
+  free(ops);
+  free(to);
+  free(ilist);
+} // placelibs()
+
+void
+placecopies(prgvar_t *pv, const char *fromdir, char **to, int *ilist,
+              fileop *ops, arena *ap)
+{ /* One placelibs() pass, copying to to[i] each library i that is still
+   * flagged in ilist and is in fromdir, where it does not have to be.
+   * ops is scratch space for the batch.
+  */
+  /* One listing of fromdir saves a stat() of every name that is not in
+   * it. */
+  strlist *have = dirnames(fromdir);
+  size_t *idx = xmalloc(pv->libswlist->count * sizeof(size_t));
+  char buf[PATH_MAX];
+  size_t i, j, n = 0;
+  for (i = 0; i < pv->libswlist->count; i++) {
+    if (!ilist[i] || !maybeindir(have, strlist_item(pv->libswlist, i)))
+      continue;
+    sprintf(buf, "%s/%s", fromdir, strlist_item(pv->libswlist, i));
+    if (!exists_file(buf)) continue; // a dir or FIFO is not the library.
+    ops[n].op = FOP_COPY;
+    ops[n].from = arena_strdup(ap, buf);
+    ops[n].to = to[i];
+    idx[n++] = i;
   } // for()
-  for (i = 0; i < count; i++) { // dependencies for the makefile.
-    if (ilist[i]) {
-      fprintf(stderr, "File: %s does not exist.\n", pv->libswlist[i]);
+  fileops_run(ops, n, 0);
+  for (j = 0; j < n; j++) {
+    if (ops[j].err == 0) {
+      ilist[idx[j]] = 0;
+    } else if (ops[j].err != ENOENT || ops[j].errpath != ops[j].from) {
+      // only a source that went missing means it is not here.
+      fprintf(stderr, "%s: %s\n", ops[j].errpath, strerror(ops[j].err));
+      exit(EXIT_FAILURE);
     }
   } // for()
-} // placelibs()
+  free(idx);
+  free(have);
+} // placecopies()
+
+int
+maybeindir(strlist *names, const char *name)
+{ /* 0 if name is certainly not in the dir listed by dirnames() as
+   * names, 1 if it is or the listing failed.
+  */
+  if (!names) return 1;
+  size_t i;
+  for (i = 0; i < names->count; i++) {
+    if (strcmp(strlist_item(names, i), name) == 0) return 1;
+  }
+  return 0;
+} // maybeindir()
 
 void
 maketargetoptions(prgvar_t *pv, newopt_t **nopl)
@@ -533,10 +590,8 @@ maketargetoptions(prgvar_t *pv, newopt_t **nopl)
 void
 maketoheader(prgvar_t *pv, newopt_t **nopl)
 { /* generates the options_t struct */
-  mdata *md = gettargetfile(pv, "gopt.h");
-  setfileownertext(pv, md);
-  char buf[PATH_MAX];
-  buf[0] = 0;
+  char owner[NAME_MAX];
+  strbld *sb = strbld_new(0);
   size_t i;
   for (i = 0; nopl[i]; i++) {
     char *purpose = nopl[i]->purpose;
@@ -545,73 +600,72 @@ maketoheader(prgvar_t *pv, newopt_t **nopl)
     char *cmnt = nopl[i]->runfunc;
     char *cp;
     if (purpose) cp = purpose; else cp = ctype;
-    char line[NAME_MAX];
-    sprintf(line, "\t%s\t%s\t// %s, %s", ctype, vname, cp, cmnt);
-    strjoin(buf, '\n', line, PATH_MAX);
+    strbld_printf(sb, "%s\t%s\t%s\t// %s, %s", i ? "\n" : "",
+                  ctype, vname, cp, cmnt);
   }
-  memreplace(md, "<struct>", buf, PATH_MAX);
+  const pair tbl[] = {
+    { "<file owner>", fileownertext(pv, owner) },
+    { "<struct>",     sb->buf },
+  };
+  mdata *md = rendertarget(pv, "gopt.h", tbl, 2);
+  free_strbld(sb);
   memreplace(md, "char*\t", "char\t*", 16); // char* xyz -> char *xyz
-  char *path = settargetfilename(pv, "gopt.h");
-  writefile(path, md->fro, md->to, "w" );
+  char path[PATH_MAX];
+  settargetfilename_r(pv, "gopt.h", path);
+  writemdata(path, md, WF_ATOMIC);
   free_mdata(md);
 } // maketoheader()
 
 void
 maketoCfile(prgvar_t *pv, newopt_t **nopl)
-{ /* Deals with <file owner>, <optstring>, <longopt>, and
+{ /* Deals with <file owner>, <optstring>, <defaults>, <longopt>, and
    * <cases>, in template file.
   * */
-  mdata *md = gettargetfile(pv, "gopt.c");
-  setfileownertext(pv, md);
-  char *cp = buildoptstring(nopl);
-  memreplace(md, "<optstring>", cp, NAME_MAX);
-  cp = builddefaults(nopl);
-  if (cp) {
-    memreplace(md, "<defaults>", cp, PATH_MAX);
-  } else memdel(md, "<defaults>");
-  cp = buildlongopts(nopl);
-  if (cp) memreplace(md, "<longopt>", cp, PATH_MAX);
-  cp = buildcases(nopl);
-  if (cp) memreplace(md, "<cases>", cp, PATH_MAX);
-  char *path = settargetfilename(pv, "gopt.c");
-  writefile(path, md->fro, md->to, "w" );
-  free_mdata(md);
+  char owner[NAME_MAX];
+  strbld *sb[4];
+  size_t i;
+  for (i = 0; i < 4; i++) sb[i] = strbld_new(0);
+  const pair tbl[] = {
+    { "<file owner>", fileownertext(pv, owner) },
+    { "<optstring>",  buildoptstring_r(nopl, sb[0]) },
+    { "<defaults>",   builddefaults_r(nopl, sb[1]) }, // NULL deletes it.
+    { "<longopt>",    buildlongopts_r(nopl, sb[2]) },
+    { "<cases>",      buildcases_r(nopl, sb[3]) },
+  };
+  writetarget(pv, "gopt.c", tbl, 5);
+  for (i = 0; i < 4; i++) free_strbld(sb[i]);
 } // maketoCfile()
 
-char *buildoptstring(newopt_t **nopl)
-{
-  static char buf[PATH_MAX];
-  strcpy(buf, ":");
+char
+*buildoptstring_r(newopt_t **nopl, strbld *sb)
+{ /* Append the getopt optstring to sb and return its string. */
+  strbld_append(sb, ":");
   size_t i;
   for (i = 0; nopl[i]; i++) {
-    strcat(buf, nopl[i]->shortopt);
+    strbld_append(sb, nopl[i]->shortopt);
   } // for()
-  return buf;
-} // buildoptstring()
+  return sb->buf;
+} // buildoptstring_r()
 
 char
-*builddefaults(newopt_t **nopl)
-{ /* Deals with presence or absence of non-zero default values. */
-  static char buf[PATH_MAX];
-  buf[0] = 0;
+*builddefaults_r(newopt_t **nopl, strbld *sb)
+{ /* Deals with presence or absence of non-zero default values. The
+   * assignments are appended to sb, NULL is returned if there are none.
+  */
   size_t i;
   for (i = 0; nopl[i]; i++) {
     char *cp = nopl[i]->dflt_val;
     if (strcmp(cp, "0") == 0) continue;
     if (strcmp(cp, "0.0") == 0) continue;
     if (strstr(cp, "NULL")) continue;
-    char name[NAME_MAX];
-    sprintf(name, "\topts.%s = %s;\n", nopl[i]->varname, cp);
-    strcat(buf, name);
+    strbld_printf(sb, "\topts.%s = %s;\n", nopl[i]->varname, cp);
   } // for()
-  if (strlen(buf)) return buf; else return (char*)NULL;
-} // builddefaults()
+  if (sb->len) return sb->buf; else return (char*)NULL;
+} // builddefaults_r()
 
 char
-*buildlongopts(newopt_t **nopl)
-{
-  static char buf[PATH_MAX];
-  buf[0] = 0;
+*buildlongopts_r(newopt_t **nopl, strbld *sb)
+{ /* Append the struct option initialisers to sb. */
   size_t i;
   for (i = 0; nopl[i]; i++) {
     char *cp = nopl[i]->longopt;
@@ -619,33 +673,26 @@ char
     int colon = 0;
     if (strstr(sp, "::")) colon = 2;
     else if (strstr(sp, ":")) colon = 1;
-    char name[NAME_MAX];
-    sprintf(name, "\t\t{\"%s\",\t%d,\t0,\t\'%c\' },",
-              cp, colon, sp[0]);
-    strjoin(buf, '\n', name, PATH_MAX);
+    strbld_printf(sb, "%s\t\t{\"%s\",\t%d,\t0,\t\'%c\' },",
+                  sb->len ? "\n" : "", cp, colon, sp[0]);
   } // for()
-  return buf;
-} // buildlongopts()
+  return sb->buf;
+} // buildlongopts_r()
 
 char
-*buildcases(newopt_t **nopl)
-{
-  static char buf[PATH_MAX];
-  buf[0] = 0;
+*buildcases_r(newopt_t **nopl, strbld *sb)
+{ /* Append the switch cases for each option to sb. */
   size_t i;
   for (i = 0; nopl[i]; i++) {
     char *so = nopl[i]->shortopt;
     char *vn = nopl[i]->varname;
     char *rv = getoptrval(nopl[i]->ctype, nopl[i]->purpose);
-    char name[NAME_MAX];
-    sprintf(name, "\t\tcase \'%c\':\n\t\t\topts.%s = %s;",
-              so[0], vn, rv);
-    strjoin(buf, '\n', name, PATH_MAX);
     // to deal with maxval later
-    strjoin(buf, '\n', "\t\tbreak;", PATH_MAX);
+    strbld_printf(sb, "%s\t\tcase \'%c\':\n\t\t\topts.%s = %s;"
+                  "\n\t\tbreak;", sb->len ? "\n" : "", so[0], vn, rv);
   } // for()
-  return buf;
-} // buildcases()
+  return sb->buf;
+} // buildcases_r()
 
 char
 *getoptrval(const char *ctype, const char *purpose)
@@ -666,62 +713,97 @@ char
 mdata
 *gettargetfile(prgvar_t *pv, const char *fn)
 { /* readfile to take care of errors. */
-  char *path = settargetfilename(pv, fn);
+  char path[PATH_MAX];
+  settargetfilename_r(pv, fn, path);
   mdata *md = readfile(path, 0, 1);
   return md;
 } // gettargetfile()
 
+mdata
+*rendertarget(prgvar_t *pv, const char *fn, const pair *tbl, size_t n)
+{ /* Render the template copied into the target dir as fn, filling in
+   * its placeholders from tbl in a single pass.
+  */
+  tmpl *tp = tmpl_compile(gettargetfile(pv, fn));
+  mdata *md = tmpl_render(tp, tbl, n);
+  free_tmpl(tp);
+  return md;
+} // rendertarget()
+
 void
-setfileownertext(prgvar_t *pv, mdata *md)
-{ /* Writes the copyright ownership text near the top of a file. */
-  char buf[NAME_MAX];
+writetarget(prgvar_t *pv, const char *fn, const pair *tbl, size_t n)
+{ /* As rendertarget() but the result replaces the target file, written
+   * straight from the template pieces and tbl values without building
+   * it in memory first.
+  */
+  char path[PATH_MAX];
+  settargetfilename_r(pv, fn, path);
+  tmpl *tp = tmpl_compile(readfile(path, 1, 1));
+  size_t count;
+  struct iovec *iov = tmpl_iov(tp, tbl, n, &count);
+  writefilev(path, iov, count, WF_ATOMIC);
+  free(iov);
+  free_tmpl(tp);
+} // writetarget()
+
+char
+*fileownertext(prgvar_t *pv, char *buf)
+{ /* Makes the copyright ownership text for the top of a file in buf,
+   * which must be NAME_MAX in size.
+  */
   time_t now = time(NULL);
-  struct tm *lt = localtime(&now);
-  int yy = lt->tm_year + 1900;
+  struct tm lt;
+  localtime_r(&now, &lt);
+  int yy = lt.tm_year + 1900;
   sprintf(buf, "%d %s %s", yy, pv->pi->author, pv->pi->email);
-  memreplace(md, "<file owner>", buf, NAME_MAX);
-} // setfileownertext()
+  return buf;
+} // fileownertext()
 
 char
-*settargetfilename(prgvar_t *pv, const char *fn)
-{
-  static char path[PATH_MAX];
-  strcpy(path, pv->newdir);
-  strjoin(path, '/', fn, PATH_MAX);
-  return path;
-} // settargetfilename()
+*settargetfilename_r(prgvar_t *pv, const char *fn, char *buf)
+{ /* Make the path of fn in the target dir in buf, which must be
+   * PATH_MAX in size.
+  */
+  strcpy(buf, pv->newdir);
+  strjoin(buf, '/', fn, PATH_MAX);
+  return buf;
+} // settargetfilename_r()
 
 void
 makemain(prgvar_t *pv, newopt_t **nopl)
 { /*  Copy main.c template to source file name and fill in targets. */
-  char *pathto = settargetfilename(pv, pv->pi->src);
-  copyfile("./templates/main.c", pathto);
-  mdata *md = gettargetfile(pv, pv->pi->src);
-  setfileownertext(pv, md);
-  memreplace(md, "<exename>", pv->pi->exe, NAME_MAX);
-  generatepvstruct(md, nopl);
-  char *path = settargetfilename(pv, pv->pi->src);
-  writefile(path, md->fro, md->to, "w" );
-  free_mdata(md);
-} // makemain()
-
-void
-generatepvstruct(mdata *md, newopt_t **nopl)
-{ /* There is an empty prgvar_t struct in the new main(), this
-   * fills it in with data that might be useful.
-   * It also provides the code to free this struct.
+  char path[PATH_MAX];
+  settargetfilename_r(pv, pv->pi->src, path);
+  copyfile("./templates/main.c", path);
+  /* There is an empty prgvar_t struct in the new main(), this fills it
+   * in with data that might be useful. It also provides the code to
+   * free this struct.
   */
-  genpvstructopt(md, nopl); // options in the new program.
-  genpvstructarg(md, nopl); // non-opt args in the new program.
-  genpvstructfreeopt(md, nopl); // free the struct objects
-  genpvstructfreearg(md, nopl); // in the new program.
-} // generatepvstruct()
+  char owner[NAME_MAX];
+  strbld *sopt = strbld_new(0), *sarg = strbld_new(0);
+  strbld *fopt = strbld_new(0), *farg = strbld_new(0);
+  genpvstructopt(sopt, nopl); // options in the new program.
+  genpvstructarg(sarg, nopl); // non-opt args in the new program.
+  genpvstructfreeopt(fopt, nopl); // free the struct objects
+  genpvstructfreearg(farg, nopl); // in the new program.
+  const pair tbl[] = {
+    { "<file owner>",   fileownertext(pv, owner) },
+    { "<exename>",      pv->pi->exe },
+    { "<struct opt>",   sopt->buf },
+    { "<fstruct opt>",  fopt->buf },
+  };
+  /* sarg and farg are not yet generated so <struct arg> and
+   * <fstruct arg> are left in place for now. */
+  writetarget(pv, pv->pi->src, tbl, 4);
+  free_strbld(sopt);
+  free_strbld(sarg);
+  free_strbld(fopt);
+  free_strbld(farg);
+} // makemain()
 
 void
-genpvstructopt(mdata *md, newopt_t **nopl)
-{
-  char buf[PATH_MAX];
-  buf[0] = 0;
+genpvstructopt(strbld *sb, newopt_t **nopl)
+{ /* Append the option members of the new prgvar_t to sb. */
   size_t i;
   for (i = 0; nopl[i]; i++) {
     char *vn = nopl[i]->varname;
@@ -729,18 +811,14 @@ genpvstructopt(mdata *md, newopt_t **nopl)
     char *ct = nopl[i]->ctype;
     char *of = nopl[i]->runfunc;
     if (strcmp(of, "FIXME") == 0) {
-      char name[NAME_MAX];
-      sprintf(name, "\t%s pvop_%s;\t// FIXME", ct, vn);
-      strjoin(buf, '\n', name, PATH_MAX);
+      strbld_printf(sb, "%s\t%s pvop_%s;\t// FIXME",
+                    sb->len ? "\n" : "", ct, vn);
     } // if()
   } // for()
-  memreplace(md, "<struct opt>", buf, PATH_MAX);
 } // genpvstructopt()
 
-void genpvstructarg(mdata *md, newopt_t **nopl)
-{
-  char buf[PATH_MAX];
-  buf[0] = 0;
+void genpvstructarg(strbld *sb, newopt_t **nopl)
+{ /* Append the non-option members of the new prgvar_t to sb. */
   size_t i;
   return; // code needs revision first.
   for (i = 0; nopl[i]; i++) {
@@ -749,33 +827,28 @@ void genpvstructarg(mdata *md, newopt_t **nopl)
     char *ct = purposetoCtype(pp);
     char *of = nopl[i]->runfunc;
     if (strcmp(of, "FIXME") == 0) {
-      char name[NAME_MAX];
-      sprintf(name, "\t%s pvop_%s;\t// FIXME", ct, vn);
-      strjoin(buf, '\n', name, PATH_MAX);
+      strbld_printf(sb, "%s\t%s pvop_%s;\t// FIXME",
+                    sb->len ? "\n" : "", ct, vn);
     } // if()
   } // for()
-  memreplace(md, "<struct opt>", buf, PATH_MAX);
 } // genpvstructarg()
 
-void genpvstructfreeopt(mdata *md, newopt_t **nopl)
-{
-  char buf[PATH_MAX];
-  buf[0] = 0;
+void genpvstructfreeopt(strbld *sb, newopt_t **nopl)
+{ /* Append the code freeing the option members to sb. */
   size_t i;
   for (i = 0; nopl[i]; i++) {
     char *vn = nopl[i]->varname;
     char *of = nopl[i]->runfunc;
     if (strcmp(of, "FIXME") == 0) { // TODO only string C types.
-      char name[NAME_MAX];
-      sprintf(name, "\tif (pv->%s) free(pv->%s);\t// FIXME", vn, vn);
-      strjoin(buf, '\n', name, PATH_MAX);
+      strbld_printf(sb, "%s\tif (pv->%s) free(pv->%s);\t// FIXME",
+                    sb->len ? "\n" : "", vn, vn);
     } // if()
   } // for()
-  memreplace(md, "<fstruct opt>", buf, PATH_MAX);
 } // genpvstructfreeopt()
 
-void genpvstructfreearg(mdata *md, newopt_t **nopl)
-{
+void genpvstructfreearg(strbld *sb, newopt_t **nopl)
+{ /* Append the code freeing the non-option members to sb. */
+  (void)sb;
 } // genpvstructfreearg()
 
 
@@ -791,15 +864,15 @@ generatemakefile(prgvar_t *pv)
   copyfile("./templates/Makefile.am", mfname);
   mdata *md = readfile(mfname, 1, 1024);
   memreplace(md, "progname", pv->pi->exe, 1024);
-  char joinbuf[NAME_MAX];
-  int i;
-  strcpy(joinbuf, pv->libswlist[0]);
-  for (i = 1; pv->libswlist[i]; i++) {  // NULL terminated list
-    strjoin(joinbuf, ' ', pv->libswlist[i], NAME_MAX);
+  strbld *sb = strbld_new(0);
+  size_t i;
+  for (i = 0; i < pv->libswlist->count; i++) {
+    strbld_join(sb, ' ', strlist_item(pv->libswlist, i));
   }
-  memreplace(md, "SWLIBS", joinbuf, 1024);
+  memreplace(md, "SWLIBS", sb->buf, 1024);
+  free_strbld(sb);
   memreplace(md, "TLA", pv->pi->thr, 1024);
-  writefile(mfname, md->fro, md->to, "w");
+  writemdata(mfname, md, WF_ATOMIC);
   free_mdata(md);
 } // generatemakefile()
 
@@ -857,7 +930,7 @@ addautotools(prgvar_t *pv)
             "AM_INIT_AUTOMAKE\nac_config_srcdir", 128);
   // Original value of search target restored.
   memreplace(cfd, "ac_config_srcdir", "AC_CONFIG_SRCDIR", 128);
-  writefile("configure.ac", cfd->fro, cfd->to, "w");
+  writemdata("configure.ac", cfd, WF_ATOMIC);
   xsystem("autoheader", 1);
   xsystem("aclocal", 1);
   xsystem("automake --add-missing --copy", 1);
@@ -887,7 +960,8 @@ makehelperscripts(prgvar_t *pv)
     perror(to);
     exit(EXIT_FAILURE);
   }
-  
+  fs_invalidate(to); // its mode changed.
+
   // workaround auto tools bugs
 } // makehelperscripts()
 
@@ -935,13 +1009,15 @@ void
 prgvar_tfree(prgvar_t *pv)
 { /* allow that any object to free may be NULL */
   if (!pv) return;
-  if (pv->optsout)    freestringlist(pv->optsout, 0);
   if (pv->pi)         progidfree(pv->pi);
-  if (pv->libswlist)  freestringlist(pv->libswlist, 0);
-  if (pv->extras)     freestringlist(pv->extras, 0);
   if (pv->newdir)     free(pv->newdir);
   if (pv->linksdir)   free(pv->linksdir);
   if (pv->stubsdir)   free(pv->stubsdir);
+  if (pv->optsout)    free(pv->optsout);
+  if (pv->libswlist)  free(pv->libswlist);
+  if (pv->extras)     free(pv->extras);
+  if (pv->ap)         arena_free(pv->ap);
+  // pv->cfg belongs to the config cache, which lives until exit.
   free(pv);
 }  // prgvar_tfree()
 
@@ -977,45 +1053,51 @@ prgvar_t
 {
   if (optp->runhelp) dohelp(0);  // exits, no return;
   if (optp->runvsn) dovsn();  // exits, no return;
-  prgvar_t *pv = xmalloc(sizeof(struct prgvar_t));
-  pv->libswlist = getlibsoftwarenames("./defaults/lsw.dflt",
+  prgvar_t *pv = xcalloc(1, sizeof(struct prgvar_t));
+  pv->ap = arena_new(4 * PATH_MAX);
+  pv->libswlist = getlibsoftwarenames(pv->ap, "./defaults/lsw.dflt",
                                         optp->software_deps);
-  pv->extras = getextras("./defaults/extra.dflt", optp->extra_data);
-  pv->optsout = getoptionslist("./defaults/options.dflt",
+  pv->extras = getextras(pv->ap, "./defaults/extra.dflt",
+                          optp->extra_data);
+  pv->optsout = getoptionslist(pv->ap, "./defaults/options.dflt",
                                 optp->options_list);
   return pv;
 } // action_options()
 
-char
-**getlibsoftwarenames(const char *path, char *nameslist)
+strlist
+*getlibsoftwarenames(arena *ap, const char *path, char *nameslist)
 { /* consolidate all names from defaults and/or options.
    * either or both sources may be NULL.
   */
-  char buf[PATH_MAX];
-  buf[0] = 0;
-  if (exists_file(path)) {
-    char *dfp = read_defaults(path);
-    strjoin(buf, ' ', dfp, PATH_MAX);
-  }
-  if (nameslist) strjoin(buf, ' ', nameslist, PATH_MAX);
-  if (!(strlen(buf))) return (char**)NULL; 
-  char *expanded = expand_extensions(buf);
-  char **swlist = list2array(expanded, " ");
-  free(expanded);
-  return swlist;
+  char *names = gathernames(ap, path, nameslist);
+  if (!names) return (strlist *)NULL;
+  char *expanded = expand_extensions(ap, names);
+  return strlist_split(expanded, " ");
 } // getlibsoftwarenames()
 
 char
-*expand_extensions(const char *list)
+*gathernames(arena *ap, const char *path, const char *nameslist)
+{ /* Join the names from the defaults file at path, if it exists, and
+   * from nameslist, if not NULL, into one space separated list in ap.
+   * Returns NULL if there are none.
+  */
+  strbld *sb = strbld_new(0);
+  if (exists_file(path)) strbld_join(sb, ' ', read_defaults(ap, path));
+  strbld_join(sb, ' ', nameslist);
+  char *names = NULL;
+  if (sb->len) names = arena_strndup(ap, sb->buf, sb->len);
+  free_strbld(sb);
+  return names;
+} // gathernames()
+
+char
+*expand_extensions(arena *ap, const char *list)
 { /* some filenames may look like example.h+c as shorthand for
    * example.h and example.c. This expands any such shorthand into
    * the named pairs of files.
   */
-  char inbuf[PATH_MAX]; // I know that list is < PATH_MAX
-  const int twoby = PATH_MAX * 2;
-  char outbuf[2 * PATH_MAX];
-  outbuf[0] = 0;  // strjoin demands this.
-  strcpy (inbuf, list);
+  char *inbuf = arena_strdup(ap, list);  // cut up into words below.
+  strbld *sb = strbld_new(2 * strlen(list));
   char *cp = inbuf;
   while (*cp) {
     char name[FILENAME_MAX];
@@ -1025,65 +1107,53 @@ char
     char *exp = strrchr(name, '+'); // shorthand naming?
     if (exp) {
       *exp = 0;
-      strjoin(outbuf, ' ', name, twoby);  // first named file
+      strbld_join(sb, ' ', name);  // first named file
       *(exp-1) = *(exp+1);  // prepare second named file
     }
-    strjoin(outbuf, ' ', name, twoby);
+    strbld_join(sb, ' ', name);
     cp += strlen(cp) + 1;
   } // while()
-  return xstrdup(outbuf);
+  char *ret = arena_strndup(ap, sb->buf, sb->len);
+  free_strbld(sb);
+  return ret;
 } // expand_extensions()
 
 char
-*read_defaults(const char *path)
+*read_defaults(arena *ap, const char *path)
 { /* read the named path, get rid of comments, and return a space
    * separated list of non-zero length strings.
   */
-  char buf[PATH_MAX];
-  buf[0] = 0; // strjoin requires this.
+  strbld *sb = strbld_new(0);
   mdata *md = readfile(path, 0, 1);
   stripcomment(md, "#", "\n", 0);
-  char **strlist = mdatatostringlist(md);
-  size_t idx = 0;
-  while (strlist[idx]) {
-    strjoin(buf, ' ', strlist[idx], PATH_MAX);
-    idx++;
+  strlist *sl = strlist_lines(md);
+  size_t idx;
+  for (idx = 0; idx < sl->count; idx++) {
+    strbld_join(sb, ' ', strlist_item(sl, idx));
   }
-  freestringlist(strlist, 0);
+  free(sl);
   free_mdata(md);
-  return xstrdup(buf);
+  char *ret = arena_strndup(ap, sb->buf, sb->len);
+  free_strbld(sb);
+  return ret;
 } // read_defaults()
 
-char
-**getextras(const char *path, char *nameslist)
+strlist
+*getextras(arena *ap, const char *path, char *nameslist)
 { 
-  char buf[PATH_MAX];
-  buf[0] = 0;
-  if (exists_file(path)) {
-    char *dfp = read_defaults(path);
-    strjoin(buf, ' ', dfp, PATH_MAX);
-  }
-  if (nameslist) strjoin(buf, ' ', nameslist, PATH_MAX);
-  if (!(strlen(buf))) return (char**)NULL; 
-  char **extralist = list2array(buf, " ");
-  return extralist;
+  char *names = gathernames(ap, path, nameslist);
+  if (!names) return (strlist *)NULL;
+  return strlist_split(names, " ");
 } // getextras()
 
-char
-**getoptionslist(const char *path, char *nameslist)
+strlist
+*getoptionslist(arena *ap, const char *path, char *nameslist)
 { /* consolidate all names from defaults and/or options.
    * either or both sources may be NULL.
   */
-  char buf[PATH_MAX];
-  buf[0] = 0;
-  if (exists_file(path)) {
-    char *dfp = read_defaults(path);
-    strjoin(buf, ' ', dfp, PATH_MAX);
-  }
-  if (nameslist) strjoin(buf, ' ', nameslist, PATH_MAX);
-  if (!(strlen(buf))) return (char**)NULL; 
-  char **optionslist = list2array(buf, "; ");
-  return optionslist;
+  char *names = gathernames(ap, path, nameslist);
+  if (!names) return (strlist *)NULL;
+  return strlist_split(names, "; ");
 } // getoptionslist()
 
 void
@@ -1100,32 +1170,36 @@ fmtoutputctl(prgvar_t *pv)
    * tabs. This function names the output files affected and sends them
    * to fmtoutput() to have the tabs replaced with 2 spaces.
   */
+  static const pair tabs[] = {
+    { "\t\t\t\t\t\t\t", "              " },
+    { "\t\t\t\t\t\t",   "            " },
+    { "\t\t\t\t\t",     "          " },
+    { "\t\t\t\t",       "        " },
+    { "\t\t\t",         "      " },
+    { "\t\t",           "    " },
+    { "\t",             "  " },
+  };
+  acmach *ac = ac_compile(tabs, 7);  // once for all the files.
   char *fn[] = {"gopt.h", "gopt.c", pv->pi->src, (char*)NULL};
   size_t i;
   for (i = 0; fn[i]; i++) {
     mdata *md = gettargetfile(pv, fn[i]);
-    fmtoutput(md);
-    char *path = settargetfilename(pv, fn[i]);
-    writefile(path, md->fro, md->to, "w");
+    fmtoutput(ac, md);
+    char path[PATH_MAX];
+    settargetfilename_r(pv, fn[i], path);
+    writemdata(path, md, WF_ATOMIC);
     free_mdata(md);
   }
+  free_acmach(ac);
 } // fmtoutputctl()
 
 void
-fmtoutput(mdata *md)
-{ /* Replaces "\t" in *md with "  ".
+fmtoutput(acmach *ac, mdata *md)
+{ /* Replaces "\t" in *md with "  ", ac being the tab table compiled by
+   * fmtoutputctl().
    * What is really needed is to place all objects after a tab
    * replacement at an even numbered column. This thing is too stupid
    * to do that. But WTF, the target files will need editing anyway.
   */
-  char srchbuf[NAME_MAX];
-  char replbuf[NAME_MAX];
-  strcpy(srchbuf, "\t\t\t\t\t\t\t\t");
-  strcpy(replbuf, "                ");
-  size_t i;
-  for (i = 7; i > 0; i--) {
-    srchbuf[i] = 0;
-    replbuf[2*i] = 0;
-    memreplace(md, srchbuf, replbuf, 128);
-  } // for()
+  ac_replace(ac, md);
 } // fmtoutput()
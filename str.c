@@ -25,17 +25,138 @@
 
 #include "str.h"
 #include "files.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define STR_X86 1
+#endif
+
+/* Byte scanning kernels used by countmemstr(), countchar(),
+ * memlinestostr() and memstrtolines(). countbyte() returns the number
+ * of bytes == c in p[0..n), swapbyte() also overwrites each of them
+ * with 'to'. There are scalar, SSE2 and AVX2 versions, the best one the
+ * CPU supports is chosen once at startup by str_selectkernels(). All
+ * produce identical results.
+*/
+static size_t
+countbyte_scalar(const char *p, size_t n, char c)
+{ /* portable version */
+  size_t count = 0;
+  size_t i;
+  for (i = 0; i < n; i++) if (p[i] == c) count++;
+  return count;
+} // countbyte_scalar()
+
+static size_t
+swapbyte_scalar(char *p, size_t n, char c, char to)
+{ /* portable version */
+  size_t count = 0;
+  size_t i;
+  for (i = 0; i < n; i++) {
+    if (p[i] == c) {
+      p[i] = to;
+      count++;
+    }
+  }
+  return count;
+} // swapbyte_scalar()
+
+#ifdef STR_X86
+__attribute__((target("sse2")))
+static size_t
+countbyte_sse2(const char *p, size_t n, char c)
+{ /* 16 bytes at a time. */
+  const __m128i needle = _mm_set1_epi8(c);
+  size_t count = 0;
+  size_t i;
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+    count += __builtin_popcount(m);
+  }
+  return count + countbyte_scalar(p + i, n - i, c);
+} // countbyte_sse2()
+
+__attribute__((target("sse2")))
+static size_t
+swapbyte_sse2(char *p, size_t n, char c, char to)
+{ /* 16 bytes at a time, untouched blocks are not written back. */
+  const __m128i needle = _mm_set1_epi8(c);
+  const __m128i repl = _mm_set1_epi8(to);
+  size_t count = 0;
+  size_t i;
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+    __m128i eq = _mm_cmpeq_epi8(v, needle);
+    unsigned m = _mm_movemask_epi8(eq);
+    if (!m) continue;
+    count += __builtin_popcount(m);
+    v = _mm_or_si128(_mm_andnot_si128(eq, v), _mm_and_si128(eq, repl));
+    _mm_storeu_si128((__m128i *)(p + i), v);
+  }
+  return count + swapbyte_scalar(p + i, n - i, c, to);
+} // swapbyte_sse2()
+
+__attribute__((target("avx2,popcnt")))
+static size_t
+countbyte_avx2(const char *p, size_t n, char c)
+{ /* 32 bytes at a time. */
+  const __m256i needle = _mm256_set1_epi8(c);
+  size_t count = 0;
+  size_t i;
+  for (i = 0; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    unsigned m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+    count += __builtin_popcount(m);
+  }
+  return count + countbyte_scalar(p + i, n - i, c);
+} // countbyte_avx2()
+
+__attribute__((target("avx2,popcnt")))
+static size_t
+swapbyte_avx2(char *p, size_t n, char c, char to)
+{ /* 32 bytes at a time, untouched blocks are not written back. */
+  const __m256i needle = _mm256_set1_epi8(c);
+  const __m256i repl = _mm256_set1_epi8(to);
+  size_t count = 0;
+  size_t i;
+  for (i = 0; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+    __m256i eq = _mm256_cmpeq_epi8(v, needle);
+    unsigned m = _mm256_movemask_epi8(eq);
+    if (!m) continue;
+    count += __builtin_popcount(m);
+    _mm256_storeu_si256((__m256i *)(p + i),
+                        _mm256_blendv_epi8(v, repl, eq));
+  }
+  return count + swapbyte_scalar(p + i, n - i, c, to);
+} // swapbyte_avx2()
+#endif
+
+static size_t (*countbyte)(const char *, size_t, char) = countbyte_scalar;
+static size_t (*swapbyte)(char *, size_t, char, char) = swapbyte_scalar;
+
+__attribute__((constructor))
+static void
+str_selectkernels(void)
+{ /* Choose the byte scanning kernels to suit the CPU we are on. */
+#ifdef STR_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    countbyte = countbyte_avx2;
+    swapbyte = swapbyte_avx2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    countbyte = countbyte_sse2;
+    swapbyte = swapbyte_sse2;
+  }
+#endif
+} // str_selectkernels()
+
+static strlist *strlist_alloc(size_t count, size_t bytes);
 
 size_t
 countmemstr(mdata *md)
 { /* In memory block specified by md, count the number of C strings. */
-	char *cp = md->fro;
-	size_t c = 0;
-	while (cp < md->to) {
-		if (*cp == 0) c++;
-		cp++;
-	}
-	return c;
+	return countbyte(md->fro, md->to - md->fro, 0);
 } // countmemlines()
 
 char
@@ -69,43 +190,54 @@ mdata
 {
 	mdata *md = xmalloc(sizeof(mdata));
 	md->fro = md->to = md->limit = (char *)NULL;
+	md->flags = 0;
 	return md;
 } // init_mdata()
 
+static char
+*mdalloc(size_t *size, unsigned *flags)
+{ /* Allocate a block for an mdata. Blocks of MD_MAPMIN or more are
+   * anonymous mappings so that they can be grown by mremap(), for these
+   * *size is rounded up to whole pages. The block is not zeroed.
+  */
+  *flags &= ~MD_FILEMAP;
+  if (*size < MD_MAPMIN) {
+    *flags &= ~MD_MMAP;
+    return xmalloc(*size);
+  }
+  size_t pg = sysconf(_SC_PAGESIZE);
+  *size = (*size + pg - 1) & ~(pg - 1);
+  void *p = mmap(NULL, *size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (p == MAP_FAILED) {
+    fputs("Out of memory\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  *flags |= MD_MMAP;
+  return p;
+} // mdalloc()
+
+static void
+mdrelease(char *p, size_t size, unsigned flags)
+{ /* Give back a block from mdalloc() */
+  if (!p) return;
+  if (flags & (MD_MMAP | MD_FILEMAP)) munmap(p, size); else free(p);
+} // mdrelease()
+
 void
 meminsert(const char *line, mdata *dd, size_t meminc)
 {	/* insert line into the data block described by dd, taking care of
-	 * necessary memory reallocation as needed.
+	 * necessary memory reallocation as needed. meminc is the size of
+	 * the first allocation, after that capacity doubles as needed.
 	*/
-  const size_t fence = 8;
 	size_t len = strlen(line);
-	size_t safelen = len + fence;
-	if (safelen > (unsigned)(dd->limit - dd->to)) { // >= 0 always
-		/* Ensure that line always has room to fit. */
-		size_t needed = (meminc > safelen) ? meminc : safelen;
-		memresize(dd, needed);
-	}
-	strcpy(dd->to, line);
+	size_t want = len + 1;
+	if (!dd->fro && meminc > want) want = meminc;
+	mdata_reserve(dd, want);
+	memcpy(dd->to, line, len + 1);
 	dd->to += len+1;
 } // meminsert()
 
-/* There's a bug in memreplace(). It manifests as dofopen() segfaulting
- * when run immediately after a run of memreplace(). dofopen() should
- * never segfault, it can and should abort when there is some problem
- * with the file it's trying to open. So I am clobbering some memory, I
- * suppose with some kind of write beyond my malloc'd space.
- *
- * The problem happens when available space is == space needed or
- * available space is 1 more than space needed.
- * If available space is 1 less than needed, a resize is forced and all
- * is well. If available space is 2 more than needed it works as well.
- *
- * If I am off by 1 somewhere I can't see where. Is memmove() doing
- * something it shouldn't oughta?
- *
- * Workaround - I'll put an 8 byte fudge fence into the thing.
- * */
-
 int
 printstrlist(char **list)
 {
@@ -118,72 +250,118 @@ printstrlist(char **list)
 
 void
 memreplace(mdata *md, char *find, char *repl, off_t meminc)
-{/* Replace find with repl for every occurrence in the data block md. */
+{/* Replace find with repl for every occurrence in the data block md.
+  * The matches are counted first so that the block is reallocated at
+  * most once, then the result is built in one forward pass. That is
+  * done in place when repl is no longer than find, otherwise into a new
+  * block with meminc bytes to spare.
+  * An earlier version did a memmove() of the whole tail for each match,
+  * moving flen bytes too many, and so needed a guard fence beyond
+  * md->to. Building forward does away with both.
+*/
 	size_t flen = strlen(find);
+	if (!flen) return;
 	size_t rlen = strlen(repl);
-	off_t ldiff = rlen - flen;
-	const off_t fudge_fence = 8;	// see bug commentary above.
+	size_t count = 0;
 	char *fp = md->fro;
-	fp = memmem(fp, md->to - fp, find, flen);
-	while (fp) {
-		off_t avail = md->limit - md->to;
-		if (ldiff + fudge_fence > avail) {
-			off_t fpoffset = fp - md->fro;	// Handle relocation.
-			// Ensure that the resized memory has space to fit new data.
-			off_t actualinc = (meminc > ldiff)
-								? meminc : ldiff + fudge_fence;
-			/* Ensure that we never have available space within 0 or 1
-			 * bytes of the needed space. */
-			memresize(md, actualinc);
-			fp = md->fro + fpoffset;
-		}
-		char *movefro = fp + flen;
-		char *moveto = fp + rlen;
-		size_t mlen = md->to - fp;
-		memmove(moveto, movefro, mlen);
-		memcpy(fp, repl, rlen);
-		md->to += ldiff;
-		fp = memmem(fp, md->to - fp, find, flen);
+	while ((fp = memmem(fp, md->to - fp, find, flen))) {
+		count++;
+		fp += flen;
+	}
+	if (!count) return;
+	char *rd = md->fro;	// read from here
+	char *wr;	// write to here
+	char *nfro;	// the start of the output block.
+	size_t newcap = md->limit - md->fro;
+	unsigned nflags = md->flags;
+	if (rlen <= flen) {
+		nfro = wr = md->fro;
+	} else {
+		size_t newlen = (md->to - md->fro) + count * (rlen - flen);
+		newcap = newlen + 1;	// room for '\0'
+		if (meminc > 0) newcap += meminc;
+		nfro = wr = mdalloc(&newcap, &nflags);
+	}
+	while ((fp = memmem(rd, md->to - rd, find, flen))) {
+		size_t n = fp - rd;
+		memmove(wr, rd, n);	// in place, wr <= rd always.
+		wr += n;
+		memcpy(wr, repl, rlen);
+		wr += rlen;
+		rd = fp + flen;
 	} // while(fp)
+	size_t n = md->to - rd;
+	memmove(wr, rd, n);
+	wr += n;
+	if (wr < nfro + newcap) *wr = 0;
+	if (nfro != md->fro) mdrelease(md->fro, md->limit - md->fro, md->flags);
+	md->fro = nfro;
+	md->to = wr;
+	md->limit = nfro + newcap;
+	md->flags = nflags;
 } // memreplace()
 
 void
 memresize(mdata *dd, off_t change)
 {	/* Alter the the size of a malloc'd memory block.
 	 * Takes care of any relocation of the original pointer.
-	 * Writes 0 over the new space when increasing size.
+	 * New space is not initialised.
 	 * Handles memory allocation failure.
+	 * Blocks reaching MD_MAPMIN move to an anonymous mapping and are
+	 * resized from then on by mremap(), which need not copy. A block
+	 * mapped from a file by readfile_map() is first copied out of it.
 	*/
 	size_t now = dd->limit - dd->fro;
 	size_t dlen = dd->to - dd->fro;
 	size_t newsize = now + change;	// change can be negative
-	dd->fro = realloc(dd->fro, newsize);
-	if (!dd->fro) {
+	char *p;
+	if (dd->flags & MD_FILEMAP) {
+		unsigned flags = dd->flags;
+		p = mdalloc(&newsize, &flags);
+		memcpy(p, dd->fro, (dlen < newsize) ? dlen : newsize);
+		munmap(dd->fro, now);
+		dd->flags = flags;
+	} else if (dd->flags & MD_MMAP) {
+		p = mremap(dd->fro, now, newsize, MREMAP_MAYMOVE);
+		if (p == MAP_FAILED) p = NULL;
+	} else if (newsize >= MD_MAPMIN) {
+		unsigned flags = dd->flags;
+		p = mdalloc(&newsize, &flags);
+		memcpy(p, dd->fro, dlen);
+		free(dd->fro);
+		dd->flags = flags;
+	} else {
+		p = realloc(dd->fro, newsize);
+	}
+	if (!p) {
 		fputs("Out of memory\n", stderr);
 		exit(EXIT_FAILURE);
 	}
+	dd->fro = p;
 	dd->limit = dd->fro + newsize;
 	dd->to = dd->fro + dlen;
-	if (dd->limit > dd->to) {	// will be the case after an increase.
-		memset(dd->to, 0, dd->limit - dd->to);
-	}
 } // memresize()
 
+void
+mdata_reserve(mdata *md, size_t n)
+{ /* Ensure that at least n bytes are free after md->to. When growing,
+   * capacity is at least doubled so that appending costs amortised O(1).
+  */
+  size_t cap = md->limit - md->fro;
+  size_t need = (md->to - md->fro) + n;
+  if (need <= cap) return;
+  size_t newcap = 2 * cap;
+  if (newcap < 64) newcap = 64;
+  if (newcap < need) newcap = need;
+  memresize(md, newcap - cap);
+} // mdata_reserve()
+
 int
 memlinestostr(mdata *md)
 { /* In the block of memory enumerated by md, replace all '\n' with
    * '\0' and return the number of replacements done.
   */
-	size_t lcount = 0;
-	char *cp = md->fro;
-	while (cp < md->to) {
-		if (*cp == '\n') {
-			*cp = 0;
-			lcount++;
-		}
-		cp++;
-	}
-	return lcount;
+	return swapbyte(md->fro, md->to - md->fro, '\n', 0);
 } // memlinestostr()
 
 size_t
@@ -191,20 +369,11 @@ memstrtolines(mdata *md)
 { /* In the block of memory enumerated by md, replace all '\0' with
    * '\n' and return the number of replacements done.
   */
-	size_t scount = 0;
-	char *cp = md->fro;
-	while (cp < md->to) {
-		if (*cp == 0) {
-			*cp = '\n';
-			scount++;
-		}
-		cp++;
-	}
-	return scount;
+	return swapbyte(md->fro, md->to - md->fro, 0, '\n');
 } // memstrtolines()
 
 void
-strjoin(char *left, char sep, char *right, size_t max)
+strjoin(char *left, char sep, const char *right, size_t max)
 {/*	Join right onto left, ensuring that sep is between left and right.
 	* Left is a buffer of length max bytes. However strlen(left) may be
 	* 0 and also sep may be '\0' and if it is this will have the effect
@@ -238,7 +407,7 @@ strjoin(char *left, char sep, char *right, size_t max)
 } // strjoin()
 
 char
-*xstrdup(char *s)
+*xstrdup(const char *s)
 {	/* strdup() with error handling */
 	char *p = strdup(s);
 	if (!p) {
@@ -250,49 +419,58 @@ char
 
 void
 *xmalloc(size_t s)
-{	// malloc with error handling
+{	// malloc with error handling, the block is not initialised.
 	void *p = malloc(s);
 	if (!p) {	// Better forget perror in this circumstance.
 		fputs("Out of memory.\n", stderr);
 		exit(EXIT_FAILURE);
 	}
-  memset(p, 0, s);  // init memory block
 	return p;
 } // xmalloc()
 
+void
+*xcalloc(size_t n, size_t s)
+{	// calloc with error handling, for when zeroed memory is needed.
+	void *p = calloc(n, s);
+	if (!p) {
+		fputs("Out of memory.\n", stderr);
+		exit(EXIT_FAILURE);
+	}
+	return p;
+} // xcalloc()
+
 char
 *getcfgdata(mdata *cfdat, char *cfgid)
-{/* Read selected line */
+{/* Read selected line. The key must match exactly. For more than one
+  * lookup parse the data once with cfg_parse() and use cfg_get().
+  * Not reentrant, see getcfgdata_r().
+*/
 	static char buf[NAME_MAX];
-	buf[0] = 0;
-	char *cp = cfdat->fro;
-	size_t slen = strlen(cfgid);
-	cp = memmem(cp, cfdat->to - cp, cfgid, slen);
-	if (!cp) {
+	return getcfgdata_r(cfdat, cfgid, buf, NAME_MAX);
+} // getgfgdata()
+
+char
+*getcfgdata_r(mdata *cfdat, const char *cfgid, char *buf, size_t size)
+{/* As getcfgdata() but the value is copied into buf of size bytes. */
+	cfgstore *cs = cfg_parse(cfdat);
+	const char *val = cfg_get(cs, cfgid);
+	if (!val) {
 		fprintf(stderr, "No such parameter in config: %s\n", cfgid);
 		exit(EXIT_FAILURE);
 	}
-	cp = memchr(cp, '=', cfdat->to - cp);
-	if (!cp) {
-		fprintf(stderr, "Malformed line in config: %s\n", cfgid);
-		exit(EXIT_FAILURE);
-	}
-	cp++;	// step past '='
-	char *ep = memchr(cp, '\n', cfdat->to - cp);
-	if (!cp) {
-		fprintf(stderr, "WTF??? no line feed in config: %s\n", cfgid);
+	if (strlen(val) >= size) {
+		fprintf(stderr, "Config value too long: %s\n", cfgid);
 		exit(EXIT_FAILURE);
 	}
-	size_t dlen = ep - cp;
-	strncpy(buf, cp, dlen);
-	buf[dlen] = 0;
+	strcpy(buf, val);
+	free_cfgstore(cs);
 	return buf;
-} // getgfgdata()
+} // getcfgdata_r()
 
 void
 free_mdata(mdata *md)
 {/* Free the data pointed to by md, then free md itself. */
-	free(md->fro);
+	mdrelease(md->fro, md->limit - md->fro, md->flags);
 	free(md);
 } // freemdata()
 
@@ -311,39 +489,57 @@ vfree(void *p, ...)
 	va_end(ap);
 }
 
+static void
+*apalloc(arena *ap, size_t n)
+{ /* arena_alloc() from ap, or xmalloc() if ap is NULL. */
+  return ap ? arena_alloc(ap, n) : xmalloc(n);
+} // apalloc()
+
+static char
+*apstrndup(arena *ap, const char *s, size_t n)
+{ /* arena_strndup() from ap, or a malloc()'d copy if ap is NULL. */
+  if (ap) return arena_strndup(ap, s, n);
+  char *cp = xmalloc(n + 1);
+  memcpy(cp, s, n);
+  cp[n] = 0;
+  return cp;
+} // apstrndup()
+
 char
 **list2array(char *items, char *sep)
 { /* Operates on a list of items, separated by sep, and returns a NULL
-   * terminated array of strings.
+   * terminated array of strings, see freestringlist().
+  */
+  return list2array_a(NULL, items, sep);
+} // list2array()
+
+char
+**list2array_a(arena *ap, const char *items, const char *sep)
+{ /* As list2array() but everything is allocated from ap, or with
+   * malloc() if ap is NULL.
   */
-  size_t il = strlen(items);
   size_t sl = strlen(sep);
-	il++;
-  char *buf = xmalloc(il * sizeof(char*));
-	strcpy(buf, items);
-  char *line = buf;
+  const char *line = items;
   size_t lcount = 0;
   while (1) {
-    char *sep_p = strstr(line, sep);
+    const char *sep_p = strstr(line, sep);
     if (!sep_p) break;
     lcount++;
     line = sep_p + sl;
   }
-  lcount += 2;  // count the last item + NULL pointer at end.
-  line = buf;
-  char **res = xmalloc(lcount * sizeof(char*));
+  lcount++;  // count the last item.
+  char **res = apalloc(ap, (lcount + 1) * sizeof(char*));
+  line = items;
   size_t i;
   for (i = 0; i < lcount; i++) {
-    char *sep_p = strstr(line, sep);
-    if (sep_p) *sep_p = 0;
-    res[i] = xstrdup(line);
-    if (sep_p) line = sep_p + sl;
+    const char *sep_p = strstr(line, sep);
+    size_t len = sep_p ? (size_t)(sep_p - line) : strlen(line);
+    res[i] = apstrndup(ap, line, len);
+    line += len + sl;
   }
-  lcount--;
   res[lcount] = 0;
-  free(buf);
 	return res;
-} // list2array()
+} // list2array_a()
 
 void
 trimspace(char *buf)
@@ -372,7 +568,7 @@ freestringlist(char **wordlist, size_t count)
 */
 	size_t i = 0;
 	if (count) {
-		for (i = 0; i < count; i++) free(wordlist[count]);
+		for (i = 0; i < count; i++) free(wordlist[i]);
 	} else {
 		while (wordlist[i]) {
 			free(wordlist[i]);
@@ -443,30 +639,76 @@ stripcomment(mdata *md, const char *opn, const char *cls, int lopcls)
    * EG stripcomment(md "#", "\n", 0), stripcomment(md, "//", "\n", 0)
    * stripcomment(md, "!<--", "-->", 1, removal of C style comments
    * is similar.)
+   * The block is compacted in one forward pass and comments may be of
+   * any length. A comment with no closing string is left alone.
   */
+  size_t stlen = strlen(opn);
+  if (!(stlen)) return;
+  size_t enlen = strlen(cls);
+  if (!(enlen)) return;
+  char *rd = md->fro;  // read from here
+  char *wr = md->fro;  // write to here
   for (;;) {
-    size_t stlen = strlen(opn);
-    if (!(stlen)) return;
-    size_t enlen = strlen(cls);
-    if (!(enlen)) return;
-    char cmntbuf[PATH_MAX];
-    char *st = memmem(md->fro, md->to - md->fro, opn, stlen);
+    char *st = memmem(rd, md->to - rd, opn, stlen);
     if (!st) break;
-    char *en = memmem(st, md->to - st, cls, enlen);
+    char *en = memmem(st + stlen, md->to - (st + stlen), cls, enlen);
     if (!en) break; // Any editors that don't put '\n' at end of file?
     if (lopcls) en += enlen;
-    size_t cplen = en - st;
-    if (cplen >= PATH_MAX) {
-      fputs("Comment length is too big for buffer, quitting.\n",
-            stderr);
-      exit(EXIT_FAILURE);
-    }
-    strncpy(cmntbuf, st, cplen);
-    cmntbuf[cplen] = 0;
-    memdel(md, cmntbuf);
+    size_t keep = st - rd;
+    memmove(wr, rd, keep);
+    wr += keep;
+    rd = en;
   }
+  size_t keep = md->to - rd;
+  memmove(wr, rd, keep);
+  md->to = wr + keep;
 } // stripcomment()
 
+void
+stripccomments(mdata *md, int flags)
+{ /* Remove C comments from the source text in md in one forward pass.
+   * flags is any of SC_BLOCK, block comments each become one space,
+   * SC_LINE, line comments are removed but not their '\n', and
+   * SC_STRINGS, comment markers inside string or character literals
+   * are not treated as comments.
+  */
+  char *rd = md->fro;
+  char *wr = md->fro;
+  char *end = md->to;
+  while (rd < end) {
+    char c = *rd;
+    if ((flags & SC_STRINGS) && (c == '"' || c == '\'')) {
+      char *cp = rd + 1;  // find the end of the literal.
+      while (cp < end && *cp != c && *cp != '\n') {
+        if (*cp == '\\' && cp + 1 < end) cp++;
+        cp++;
+      }
+      if (cp < end && *cp == c) cp++;
+      size_t len = cp - rd;
+      memmove(wr, rd, len);
+      wr += len;
+      rd = cp;
+      continue;
+    }
+    if (c == '/' && rd + 1 < end) {
+      if ((flags & SC_BLOCK) && rd[1] == '*') {
+        char *cp = memmem(rd + 2, end - (rd + 2), "*/", 2);
+        if (cp) {
+          *wr++ = ' ';
+          rd = cp + 2;
+          continue;
+        }
+      } else if ((flags & SC_LINE) && rd[1] == '/') {
+        char *cp = memchr(rd + 2, '\n', end - (rd + 2));
+        rd = cp ? cp : end;
+        continue;
+      }
+    }
+    *wr++ = *rd++;
+  } // while()
+  md->to = wr;
+} // stripccomments()
+
 char
 **loadconfigs(const char *prgname)
 { /* produces a NULL terminated list of strings of the form
@@ -478,40 +720,68 @@ char
   size_t prmcount = countchar(md, '=');
   char **cfgs = xmalloc((prmcount+1) * sizeof(char *));
   cfgs = findconfigs(md, cfgs, prmcount);
+  cfgs[prmcount] = NULL;
+  free_mdata(md);
   return cfgs;
 } // loadconfigs()
 
+strlist
+*loadconfigs_sl(const char *prgname)
+{ /* As loadconfigs() but the strings are packed into a strlist, to be
+   * released by one free().
+  */
+  char buf[PATH_MAX]; // path to config file.
+  sprintf(buf, "%s/.config/%s/%s.cfg", getenv("HOME"),prgname, prgname);
+  mdata *md = initconfigread(buf);
+  size_t prmcount = countchar(md, '=');
+  strlist *cfgs = strlist_alloc(prmcount, md->to - md->fro + prmcount);
+  char *wr = cfgs->data;
+  char *eol = md->fro;
+  size_t i;
+  for (i = 0; i < prmcount; i++) {
+    char *eq = memchr(eol, '=', md->to - eol);  // next config line
+    char *bol = eq;
+    while (bol > md->fro && bol[-1] != '\n') bol--;
+    eol = memchr(eq, '\n', md->to - eq);
+    if (!eol) eol = md->to;
+    cfgs->offs[i] = wr - cfgs->data;
+    memcpy(wr, bol, eol - bol);
+    wr += eol - bol;
+    *wr++ = 0;
+  }
+  free_mdata(md);
+  return cfgs;
+} // loadconfigs_sl()
+
 size_t
 countchar(mdata *md, const char ch)
 { /* count given char, useful rarely. */
-  size_t count = 0;
-  char *loc = memchr(md->fro, ch, md->to - md->fro);
-  while ((loc = memchr(loc, ch, md->to - loc))) {
-    count++;
-    loc++;
-  }
-  return count;
+  return countbyte(md->fro, md->to - md->fro, ch);
 } // countchar()
 
 char
 **findconfigs(mdata *md, char **cfglist, size_t nrconfigs)
 { /* duplicate the config strings onto the cfglist items */
+  return findconfigs_a(NULL, md, cfglist, nrconfigs);
+} // findconfigs()
+
+char
+**findconfigs_a(arena *ap, mdata *md, char **cfglist, size_t nrconfigs)
+{ /* As findconfigs() but the strings are allocated from ap, or with
+   * malloc() if ap is NULL.
+  */
   char *eol = md->fro;
   size_t i;
   for (i = 0; i < nrconfigs; i++) {
     char *eq = memchr(eol, '=', md->to - eol);  // next config line
     char *bol = eq;
-    while (*bol != '\n') bol--;
-    bol++;
-    eol = eq; while (*eol != '\n') eol++;
-    char buf[NAME_MAX];
-    size_t len = eol - bol;
-    strncpy(buf, bol, len);
-    buf[len] = 0;
-    cfglist[i] = xstrdup(buf);
+    while (bol > md->fro && bol[-1] != '\n') bol--;
+    eol = memchr(eq, '\n', md->to - eq);
+    if (!eol) eol = md->to;
+    cfglist[i] = apstrndup(ap, bol, eol - bol);
   }
   return cfglist;
-} // findconfigs()
+} // findconfigs_a()
 
 char
 **mdatatostringlist(mdata *md)
@@ -520,12 +790,20 @@ char
    * Leading and trailing spaces are removed.
    * Zero length strings are skipped.
   */
+  return mdatatostringlist_a(NULL, md);
+} // mdatatostringlist()
+
+char
+**mdatatostringlist_a(arena *ap, mdata *md)
+{ /* As mdatatostringlist() but allocated from ap, or with malloc() if
+   * ap is NULL.
+  */
   char *eod = md->to - 1; // check file is terminated with '\n'.
   if (*eod != '\n') {
     append_eol(md);
   }
   size_t linecount = countchar(md, '\n'); // size of output array
-  char **retval = xmalloc((linecount+1) * sizeof(char*));
+  char **retval = apalloc(ap, (linecount+1) * sizeof(char*));
   size_t idx = 0;
   char *line = md->fro;
   while (line < md->to) {
@@ -543,70 +821,726 @@ char
       } // while()
     size_t ll = strlen(begin); // ll may be 0
     if (ll) {
-      retval[idx] = xstrdup(begin);
+      retval[idx] = apstrndup(ap, begin, ll);
       idx++;
     }
     line = eol + 1;
   } // while()
   retval[idx] = 0;
   return retval;  // some wasted char* likely due 0 length lines.
-} // mdatatostringlist()
+} // mdatatostringlist_a()
 
 mdata
 *append_eol(mdata *md)
 { /* If the last char in a text file is not '\n' append one. */
-  char *eod = md->to - 1;
-  if (*eod == '\n') return md;
-  if (md->limit > md->to) {
-    eod++;
-    *eod = '\n';
-    md->to++;
-  } else {
-    memresize(md, 8);
-    eod++;
-    *eod = '\n';
-    md->to++;
-  }
+  if (md->to > md->fro && md->to[-1] == '\n') return md;
+  mdata_reserve(md, 1);
+  *md->to = '\n';
+  md->to++;
   return md;
 } // append_eol()
 
+static char
+*cfgvalue(const char *item, const char *cfgname, char *buf, size_t size)
+{ /* If item is the config cfgname, of form key=data, copy its data
+   * into buf of size bytes and return buf, else NULL.
+  */
+  size_t len = strlen(cfgname);
+  if (strncmp(item, cfgname, len) != 0) return NULL;
+  if (item[len] != '=' && item[len] != 0) return NULL; // just a prefix.
+  const char *eq = strchr(item, '=');
+  if (!eq) {
+    fprintf(stderr, "Badly formed config item: %s\n", item);
+    exit(EXIT_FAILURE);
+  }
+  if (strlen(eq+1) >= size) {
+    fprintf(stderr, "Config item too long: %s\n", cfgname);
+    exit(EXIT_FAILURE);
+  }
+  strcpy(buf, eq+1);
+  return buf;
+} // cfgvalue()
+
 char
 *getconfig(char **configs, char *cfgname)
 { /* configs is an array of strings of form key=data, NULL terminated.
-    * returns data if found, other wise NULL.
+    * returns data if found, other wise NULL. Not reentrant, see
+    * getconfig_r().
   */
   static char buf[PATH_MAX];
-  size_t len = strlen(cfgname);
+  return getconfig_r(configs, cfgname, buf, PATH_MAX);
+} // getconfig()
+
+char
+*getconfig_r(char **configs, const char *cfgname, char *buf,
+              size_t size)
+{ /* As getconfig() but the data is copied into buf of size bytes. */
   size_t i;
   for (i = 0; configs[i]; i++) {
-    if (strncmp(configs[i], cfgname, len) == 0) {
-      char *eq = strchr(configs[i], '=');
-      if (eq) {
-        strcpy(buf, eq+1);
-        return buf;
-      } else {
-        fprintf(stderr, "Badly formed config item: %s\n", configs[i]);
-        exit(EXIT_FAILURE);
-      }
-    } // if(strncmp ...)
-  } // for (i = 0 ...)
+    if (cfgvalue(configs[i], cfgname, buf, size)) return buf;
+  }
   return (char *)NULL;
-} // getconfig()
+} // getconfig_r()
 
 char
-*dictionary(char **list, char *key)
-{ /* List must be NULL terminated. Returns NULL if key not found. */
+*getconfig_sl(strlist *configs, const char *cfgname, char *buf,
+              size_t size)
+{ /* As getconfig_r() for a list from loadconfigs_sl(). */
+  size_t i;
+  for (i = 0; i < configs->count; i++) {
+    if (cfgvalue(strlist_item(configs, i), cfgname, buf, size)) return buf;
+  }
+  return (char *)NULL;
+} // getconfig_sl()
+
+char
+*dictionary(char **list, const char *key)
+{ /* List must be NULL terminated, its items of the form key=value.
+   * Returns a pointer to the value within list, NULL if key not found.
+  */
+  size_t len = strlen(key);
   size_t i;
-  char *ret = NULL;
-  static char buf[PATH_MAX];
   for (i = 0; list[i]; i++) {
-    strcpy(buf, list[i]);
-    char *eq = strchr(buf, '=');
-    *eq = 0;
-    if (strcmp(key, buf) == 0) {
-      ret = eq + 1;
-      break;
-    } // if()
+    if (strncmp(list[i], key, len) == 0 && list[i][len] == '=') {
+      return list[i] + len + 1;
+    }
   } // for()
-  return ret;
+  return (char *)NULL;
 } // dictionary()
+
+static int
+isslotchar(int c)
+{ /* chars permitted between '<' and '>' of a template placeholder. */
+  return (isalnum(c) || c == '_' || c == ' ');
+} // isslotchar()
+
+arena
+*arena_new(size_t blksize)
+{ /* Make an arena that hands out memory from blocks of blksize bytes.
+   * Nothing allocated from it is freed individually, instead it is all
+   * released by arena_reset() for reuse or by arena_free().
+  */
+  arena *ap = xmalloc(sizeof(arena));
+  ap->head = ap->cur = NULL;
+  ap->blksize = blksize;
+  return ap;
+} // arena_new()
+
+void
+*arena_alloc(arena *ap, size_t n)
+{ /* Return n bytes from ap, aligned to suit any C type. Blocks that were
+   * kept by arena_reset() are reused before new ones are malloc'd.
+  */
+  const size_t align = _Alignof(max_align_t);
+  n = (n + align - 1) & ~(align - 1);
+  arenablk *bp = ap->cur;
+  while (bp && bp->size - bp->used < n) {
+    bp = bp->next;
+    if (bp) bp->used = 0;
+  }
+  if (!bp) {
+    size_t size = (n > ap->blksize) ? n : ap->blksize;
+    bp = xmalloc(sizeof(arenablk) + size);
+    bp->size = size;
+    bp->used = 0;
+    bp->next = NULL;
+    if (ap->cur) {  // put it after cur, ahead of any kept blocks.
+      bp->next = ap->cur->next;
+      ap->cur->next = bp;
+    } else {
+      ap->head = bp;
+    }
+  }
+  ap->cur = bp;
+  void *p = bp->data + bp->used;
+  bp->used += n;
+  return p;
+} // arena_alloc()
+
+char
+*arena_strdup(arena *ap, const char *s)
+{ /* strdup() from ap. */
+  return arena_strndup(ap, s, strlen(s));
+} // arena_strdup()
+
+char
+*arena_strndup(arena *ap, const char *s, size_t n)
+{ /* Copy n bytes of s from ap and terminate them with '\0'. */
+  char *p = arena_alloc(ap, n + 1);
+  memcpy(p, s, n);
+  p[n] = 0;
+  return p;
+} // arena_strndup()
+
+void
+arena_reset(arena *ap)
+{ /* Release everything allocated from ap in one go. The blocks are kept
+   * so that later use of ap needs no further malloc().
+  */
+  ap->cur = ap->head;
+  if (ap->cur) ap->cur->used = 0;
+} // arena_reset()
+
+void
+arena_free(arena *ap)
+{ /* Free ap and all its blocks. */
+  arenablk *bp = ap->head;
+  while (bp) {
+    arenablk *next = bp->next;
+    free(bp);
+    bp = next;
+  }
+  free(ap);
+} // arena_free()
+
+static size_t
+cfg_hash(const char *key)
+{ /* FNV-1a */
+  size_t h = 2166136261u;
+  for (; *key; key++) {
+    h ^= (unsigned char)*key;
+    h *= 16777619u;
+  }
+  return h;
+} // cfg_hash()
+
+static char
+*cfg_trim(char *bp, char *ep)
+{ /* Terminate the text bp..ep with trailing space removed and return
+   * its first non-space char.
+  */
+  while (bp < ep && isspace((unsigned char)*bp)) bp++;
+  while (ep > bp && isspace((unsigned char)ep[-1])) ep--;
+  *ep = 0;
+  return bp;
+} // cfg_trim()
+
+cfgstore
+*cfg_parse(mdata *md)
+{ /* Parse config data, lines of the form key=value with '#' comments,
+   * into a hash table. Keys and values are trimmed of surrounding
+   * space, lines with no '=' are ignored and if a key is repeated the
+   * first one wins. md is not altered.
+  */
+  cfgstore *cs = xmalloc(sizeof(cfgstore));
+  size_t len = md->to - md->fro;
+  cs->text = xmalloc(len + 1);
+  memcpy(cs->text, md->fro, len);
+  cs->text[len] = 0;
+  mdata tmd = { cs->text, cs->text + len, cs->text + len + 1, 0 };
+  size_t lines = countchar(&tmd, '\n') + 1;
+  cs->nslots = 16;
+  while (cs->nslots < 2 * lines) cs->nslots *= 2;
+  cs->slots = xcalloc(cs->nslots, sizeof(pair));
+  cs->count = 0;
+  char *line = cs->text;
+  char *end = cs->text + len;
+  while (line < end) {
+    char *eol = memchr(line, '\n', end - line);
+    if (!eol) eol = end;
+    char *hash = memchr(line, '#', eol - line);
+    char *eq = memchr(line, '=', (hash ? hash : eol) - line);
+    if (eq) {
+      char *key = cfg_trim(line, eq);
+      char *val = cfg_trim(eq + 1, hash ? hash : eol);
+      size_t i = cfg_hash(key) & (cs->nslots - 1);
+      while (cs->slots[i].key && strcmp(cs->slots[i].key, key) != 0) {
+        i = (i + 1) & (cs->nslots - 1);
+      }
+      if (*key && !cs->slots[i].key) {
+        cs->slots[i].key = key;
+        cs->slots[i].val = val;
+        cs->count++;
+      }
+    }
+    line = eol + 1;
+  } // while()
+  return cs;
+} // cfg_parse()
+
+const char
+*cfg_get(cfgstore *cs, const char *key)
+{ /* Return the value for exactly key, or NULL if there is none. The
+   * pointer stays valid for the life of cs.
+  */
+  size_t i = cfg_hash(key) & (cs->nslots - 1);
+  while (cs->slots[i].key) {
+    if (strcmp(cs->slots[i].key, key) == 0) return cs->slots[i].val;
+    i = (i + 1) & (cs->nslots - 1);
+  }
+  return (const char *)NULL;
+} // cfg_get()
+
+void
+free_cfgstore(cfgstore *cs)
+{ /* free cs and all its strings. */
+  vfree(cs->slots, cs->text, cs, NULL);
+} // free_cfgstore()
+
+static strlist
+*strlist_alloc(size_t count, size_t bytes)
+{ /* One block holding the list header, count offsets and bytes of
+   * string data.
+  */
+  strlist *sl = xmalloc(sizeof(strlist) + count * sizeof(size_t) + bytes);
+  sl->count = count;
+  sl->offs = (size_t *)(sl + 1);
+  sl->data = (char *)(sl->offs + count);
+  return sl;
+} // strlist_alloc()
+
+strlist
+*strlist_split(const char *items, const char *sep)
+{ /* Operates on a list of items, separated by sep, and returns them as
+   * a packed strlist. Empty items are kept. Release it with free().
+  */
+  size_t sl = strlen(sep);
+  size_t count = 1;
+  const char *cp = items;
+  while ((cp = strstr(cp, sep))) {
+    count++;
+    cp += sl;
+  }
+  strlist *list = strlist_alloc(count, strlen(items) + 1);
+  char *wr = list->data;
+  cp = items;
+  size_t i;
+  for (i = 0; i < count; i++) {
+    const char *sep_p = strstr(cp, sep);
+    size_t len = sep_p ? (size_t)(sep_p - cp) : strlen(cp);
+    list->offs[i] = wr - list->data;
+    memcpy(wr, cp, len);
+    wr += len;
+    *wr++ = 0;
+    cp += len + sl;
+  }
+  return list;
+} // strlist_split()
+
+strlist
+*strlist_lines(mdata *md)
+{ /* mdata is always a block of lines from a text file.
+   * The lines are turned into C strings in place, leading and trailing
+   * spaces are removed and zero length lines are skipped. The list
+   * refers into md, which must outlive it. Release it with free().
+  */
+  append_eol(md);
+  size_t linecount = countchar(md, '\n');
+  strlist *sl = strlist_alloc(linecount, 0);
+  sl->data = md->fro;
+  size_t idx = 0;
+  char *line = md->fro;
+  while (line < md->to) {
+    char *eol = memchr(line, '\n', md->to - line);
+    *eol = 0;
+    char *begin = line;
+    while (begin < eol && isspace((unsigned char)*begin)) begin++;
+    char *end = eol;
+    while (end > begin && isspace((unsigned char)end[-1])) end--;
+    *end = 0;
+    if (end > begin) sl->offs[idx++] = begin - md->fro;
+    line = eol + 1;
+  } // while()
+  sl->count = idx;
+  return sl;
+} // strlist_lines()
+
+char
+*strlist_item(strlist *sl, size_t i)
+{ /* The i'th string in sl. */
+  return sl->data + sl->offs[i];
+} // strlist_item()
+
+tmpl
+*tmpl_compile(mdata *md)
+{ /* Parse the template text in md into literal spans and <placeholder>
+   * slots. The tmpl takes ownership of md. A slot is '<' followed by
+   * alphanumerics, '_' or ' ' then '>', so eg <stdio.h> stays literal.
+   * The result may be rendered any number of times by tmpl_render().
+  */
+  tmpl *tp = xmalloc(sizeof(tmpl));
+  tp->md = md;
+  size_t lt = 0;  // each '<' may split a literal span into 3.
+  char *cp = md->fro;
+  while ((cp = memchr(cp, '<', md->to - cp))) {
+    lt++;
+    cp++;
+  }
+  tp->spans = xmalloc((2 * lt + 1) * sizeof(tmplspan));
+  size_t n = 0;
+  char *lit = md->fro;  // start of the current literal span.
+  cp = md->fro;
+  while ((cp = memchr(cp, '<', md->to - cp))) {
+    char *ep = cp + 1;
+    while (ep < md->to && isslotchar((unsigned char)*ep)) ep++;
+    if (ep == cp + 1 || ep >= md->to || *ep != '>') {
+      cp++;
+      continue; // not a placeholder.
+    }
+    ep++; // include '>'
+    if (cp > lit) {
+      tp->spans[n].off = lit - md->fro;
+      tp->spans[n].len = cp - lit;
+      tp->spans[n].slot = 0;
+      n++;
+    }
+    tp->spans[n].off = cp - md->fro;
+    tp->spans[n].len = ep - cp;
+    tp->spans[n].slot = 1;
+    n++;
+    lit = cp = ep;
+  } // while()
+  if (md->to > lit) {
+    tp->spans[n].off = lit - md->fro;
+    tp->spans[n].len = md->to - lit;
+    tp->spans[n].slot = 0;
+    n++;
+  }
+  tp->nspans = n;
+  return tp;
+} // tmpl_compile()
+
+struct iovec
+*tmpl_iov(tmpl *tp, const pair *tbl, size_t n, size_t *count)
+{ /* Resolve tp against tbl as tmpl_render() does, but instead of
+   * copying return the pieces of output in order as a list of *count
+   * iovecs, for writefilev(). They point into tp and tbl, which must
+   * outlive the list. Free the list with free().
+  */
+  struct iovec *iov = xmalloc((tp->nspans + 1) * sizeof(struct iovec));
+  char *text = tp->md->fro;
+  size_t i, j, k = 0;
+  for (i = 0; i < tp->nspans; i++) {
+    tmplspan *sp = &tp->spans[i];
+    iov[k].iov_base = text + sp->off;
+    iov[k].iov_len = sp->len;
+    if (sp->slot) {
+      for (j = 0; j < n; j++) {
+        if (strlen(tbl[j].key) == sp->len
+            && memcmp(tbl[j].key, text + sp->off, sp->len) == 0) {
+          iov[k].iov_base = (char *)(tbl[j].val ? tbl[j].val : "");
+          iov[k].iov_len = strlen(iov[k].iov_base);
+          break;
+        }
+      } // for(j ...)
+    }
+    if (iov[k].iov_len) k++;  // deleted slots need no entry.
+  } // for(i ...)
+  *count = k;
+  return iov;
+} // tmpl_iov()
+
+mdata
+*tmpl_render(tmpl *tp, const pair *tbl, size_t n)
+{ /* Produce a new block from tp with every slot named as a key in tbl
+   * replaced by its val. Keys include the angle brackets, eg
+   * "<exename>". A NULL val deletes the placeholder, slots not found in
+   * tbl are output unchanged. Output is built in one linear pass.
+  */
+  size_t count, i;
+  struct iovec *iov = tmpl_iov(tp, tbl, n, &count);
+  size_t total = 0;
+  for (i = 0; i < count; i++) total += iov[i].iov_len;
+  mdata *md = init_mdata();
+  size_t cap = total + 1; // room for a terminating '\0'.
+  md->fro = mdalloc(&cap, &md->flags);
+  char *cp = md->fro;
+  for (i = 0; i < count; i++) {
+    memcpy(cp, iov[i].iov_base, iov[i].iov_len);
+    cp += iov[i].iov_len;
+  }
+  *cp = 0;
+  md->to = cp;
+  md->limit = md->fro + cap;
+  free(iov);
+  return md;
+} // tmpl_render()
+
+void
+free_tmpl(tmpl *tp)
+{ /* free tp together with the template text it owns. */
+  free_mdata(tp->md);
+  free(tp->spans);
+  free(tp);
+} // free_tmpl()
+
+acmach
+*ac_compile(const pair *tbl, size_t n)
+{ /* Build an Aho-Corasick automaton over the keys in tbl so that every
+   * key can be found in one pass over a block. The automaton refers to
+   * tbl, which must outlive it. Empty keys are ignored and when a key
+   * is repeated the first entry wins.
+  */
+  acmach *ac = xmalloc(sizeof(acmach));
+  ac->tbl = tbl;
+  ac->n = n;
+  ac->grows = 0;
+  ac->klen = xmalloc((n + 1) * sizeof(size_t));
+  size_t i, maxstates = 1;
+  for (i = 0; i < n; i++) {
+    ac->klen[i] = strlen(tbl[i].key);
+    maxstates += ac->klen[i];
+    size_t vlen = tbl[i].val ? strlen(tbl[i].val) : 0;
+    if (vlen > ac->klen[i]) ac->grows = 1;
+  }
+  ac->go = xmalloc(maxstates * 256 * sizeof(int));
+  ac->out = xmalloc(maxstates * sizeof(int));
+  ac->depth = xmalloc(maxstates * sizeof(size_t));
+  memset(ac->go, -1, maxstates * 256 * sizeof(int));
+  ac->out[0] = -1;
+  ac->depth[0] = 0;
+  ac->nstates = 1;
+  for (i = 0; i < n; i++) { // the trie
+    const unsigned char *kp = (const unsigned char *)tbl[i].key;
+    if (!*kp) continue;
+    int s = 0;
+    for (; *kp; kp++) {
+      int *g = &ac->go[s * 256 + *kp];
+      if (*g < 0) {
+        *g = ac->nstates++;
+        ac->out[*g] = -1;
+        ac->depth[*g] = ac->depth[s] + 1;
+      }
+      s = *g;
+    }
+    if (ac->out[s] < 0) ac->out[s] = i;
+  } // for()
+  /* Breadth first, turn the trie into a complete transition table and
+   * give each state the longest pattern ending there, which is its own
+   * or else that of its failure state.
+  */
+  int *fail = xmalloc(ac->nstates * sizeof(int));
+  int *queue = xmalloc(ac->nstates * sizeof(int));
+  size_t head = 0, tail = 0;
+  int c;
+  for (c = 0; c < 256; c++) {
+    int *g = &ac->go[c];
+    if (*g < 0) {
+      *g = 0;
+    } else {
+      fail[*g] = 0;
+      queue[tail++] = *g;
+    }
+  }
+  while (head < tail) {
+    int s = queue[head++];
+    if (ac->out[s] < 0) ac->out[s] = ac->out[fail[s]];
+    for (c = 0; c < 256; c++) {
+      int *g = &ac->go[s * 256 + c];
+      int f = ac->go[fail[s] * 256 + c];
+      if (*g < 0) {
+        *g = f;
+      } else {
+        fail[*g] = f;
+        queue[tail++] = *g;
+      }
+    }
+  } // while()
+  free(queue);
+  free(fail);
+  return ac;
+} // ac_compile()
+
+void
+free_acmach(acmach *ac)
+{ /* free ac, the pair table it was built from is not touched. */
+  vfree(ac->go, ac->out, ac->depth, ac->klen, ac, NULL);
+} // free_acmach()
+
+char
+*ac_next(acmach *ac, char *fro, char *to, size_t *which)
+{ /* Find the leftmost, then longest, match of any pattern in the block
+   * fro..to. Returns the start of the match and sets *which to the
+   * index of the pattern, or returns NULL if there is none.
+  */
+  char *best = NULL;
+  int s = 0;
+  char *cp;
+  for (cp = fro; cp < to; cp++) {
+    s = ac->go[s * 256 + (unsigned char)*cp];
+    // No match that is still to come can start at or before best.
+    if (best && cp - ac->depth[s] + 1 > best) break;
+    int p = ac->out[s];
+    if (p < 0) continue;
+    char *st = cp - ac->klen[p] + 1;
+    if (!best || st <= best) { // same start means longer.
+      best = st;
+      *which = p;
+    }
+  } // for()
+  return best;
+} // ac_next()
+
+size_t
+ac_replace(acmach *ac, mdata *md)
+{ /* Replace every match of ac's patterns in md with the corresponding
+   * val, a NULL val deletes the match. Matches are leftmost longest and
+   * do not overlap. Works in place unless some val is longer than its
+   * key, otherwise the block is reallocated once. Returns the number of
+   * replacements.
+  */
+  size_t count = 0, which;
+  size_t newlen = md->to - md->fro;
+  char *fp = md->fro;
+  if (ac->grows) {
+    while ((fp = ac_next(ac, fp, md->to, &which))) {
+      const char *v = ac->tbl[which].val;
+      newlen += (v ? strlen(v) : 0) - ac->klen[which];
+      fp += ac->klen[which];
+    }
+  }
+  char *rd = md->fro;
+  char *nfro = md->fro;
+  size_t newcap = md->limit - md->fro;
+  unsigned nflags = md->flags;
+  if (ac->grows) {
+    newcap = newlen + 1; // room for '\0'
+    nfro = mdalloc(&newcap, &nflags);
+  }
+  char *wr = nfro;
+  while ((fp = ac_next(ac, rd, md->to, &which))) {
+    size_t n = fp - rd;
+    memmove(wr, rd, n);
+    wr += n;
+    const char *v = ac->tbl[which].val;
+    size_t vlen = v ? strlen(v) : 0;
+    if (vlen) memcpy(wr, v, vlen);
+    wr += vlen;
+    rd = fp + ac->klen[which];
+    count++;
+  } // while()
+  size_t n = md->to - rd;
+  memmove(wr, rd, n);
+  wr += n;
+  if (wr < nfro + newcap) *wr = 0;
+  if (nfro != md->fro) mdrelease(md->fro, md->limit - md->fro, md->flags);
+  md->fro = nfro;
+  md->to = wr;
+  md->limit = nfro + newcap;
+  md->flags = nflags;
+  return count;
+} // ac_replace()
+
+size_t
+memreplace_multi(mdata *md, const pair *tbl, size_t n)
+{ /* Replace every key in tbl found in md with its val, in one pass.
+   * The table is compiled for each call, callers that apply the same
+   * table to many blocks should ac_compile() it once and use
+   * ac_replace() instead.
+  */
+  acmach *ac = ac_compile(tbl, n);
+  size_t count = ac_replace(ac, md);
+  free_acmach(ac);
+  return count;
+} // memreplace_multi()
+
+strbld
+*strbld_new(size_t hint)
+{ /* Make an empty string builder with room for hint bytes to start.
+   * Appends grow it as needed, doubling its capacity, and its length
+   * is tracked so no append needs to rescan what is there already.
+  */
+  strbld *sb = xmalloc(sizeof(strbld));
+  sb->cap = (hint < 64) ? 64 : hint + 1;
+  sb->buf = xmalloc(sb->cap);
+  sb->buf[0] = 0;
+  sb->len = 0;
+  return sb;
+} // strbld_new()
+
+void
+strbld_reserve(strbld *sb, size_t n)
+{ /* Ensure there is room for n more bytes plus the terminator. */
+  size_t need = sb->len + n + 1;
+  if (need <= sb->cap) return;
+  size_t cap = sb->cap * 2;
+  while (cap < need) cap *= 2;
+  char *p = realloc(sb->buf, cap);
+  if (!p) {
+    fputs("Out of memory.\n", stderr);
+    exit(EXIT_FAILURE);
+  }
+  sb->buf = p;
+  sb->cap = cap;
+} // strbld_reserve()
+
+void
+strbld_appendn(strbld *sb, const char *s, size_t n)
+{ /* Append n bytes of s. */
+  strbld_reserve(sb, n);
+  memcpy(sb->buf + sb->len, s, n);
+  sb->len += n;
+  sb->buf[sb->len] = 0;
+} // strbld_appendn()
+
+void
+strbld_append(strbld *sb, const char *s)
+{ /* Append the C string s. */
+  strbld_appendn(sb, s, strlen(s));
+} // strbld_append()
+
+void
+strbld_printf(strbld *sb, const char *fmt, ...)
+{ /* Append formatted output as printf() would make it. */
+  va_list ap;
+  va_start(ap, fmt);
+  size_t room = sb->cap - sb->len;
+  int n = vsnprintf(sb->buf + sb->len, room, fmt, ap);
+  va_end(ap);
+  if (n < 0) {
+    fprintf(stderr, "Bad format: %s\n", fmt);
+    exit(EXIT_FAILURE);
+  }
+  if ((size_t)n >= room) {  // did not fit, grow and do it again.
+    strbld_reserve(sb, n);
+    va_start(ap, fmt);
+    vsnprintf(sb->buf + sb->len, n + 1, fmt, ap);
+    va_end(ap);
+  }
+  sb->len += n;
+} // strbld_printf()
+
+void
+strbld_join(strbld *sb, char sep, const char *s)
+{ /* As strjoin(), append s putting sep before it unless sb is empty.
+   * Nothing is done if s is NULL or empty.
+  */
+  if (!s || !*s) return;
+  size_t n = strlen(s);
+  strbld_reserve(sb, n + 1);
+  if (sb->len) sb->buf[sb->len++] = sep;
+  memcpy(sb->buf + sb->len, s, n + 1);
+  sb->len += n;
+} // strbld_join()
+
+void
+strbld_reset(strbld *sb)
+{ /* Empty sb, keeping its memory for reuse. */
+  sb->len = 0;
+  sb->buf[0] = 0;
+} // strbld_reset()
+
+void
+strbld_truncate(strbld *sb, size_t len)
+{ /* Cut sb back to its first len bytes, if it is longer. */
+  if (len >= sb->len) return;
+  sb->len = len;
+  sb->buf[len] = 0;
+} // strbld_truncate()
+
+char
+*strbld_detach(strbld *sb)
+{ /* Free sb but not its string, which is returned for the caller to
+   * free().
+  */
+  char *buf = sb->buf;
+  free(sb);
+  return buf;
+} // strbld_detach()
+
+void
+free_strbld(strbld *sb)
+{ /* Free sb and its string. */
+  free(sb->buf);
+  free(sb);
+} // free_strbld()
@@ -28,8 +28,11 @@
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <dirent.h>
 #include <fcntl.h>
@@ -44,9 +47,75 @@
 typedef struct mdata {
 	char *fro;
 	char *to;
-	char *limit;
+	char *limit;	// end of the allocated capacity.
+	unsigned flags;	// MD_* below.
 } mdata;
 
+#define MD_MMAP	1	// fro is an anonymous mapping, grown by mremap().
+#define MD_MAPMIN	(1 << 20)	// blocks this big or bigger are mapped.
+#define MD_FILEMAP	2	// fro is a private mapping of a file, readfile_map().
+#define MD_FILEMAPMIN	(1 << 16)	// smaller files are read, not mapped.
+
+typedef struct arenablk {	/* one block of an arena. */
+	struct arenablk *next;
+	size_t size;	// usable bytes in data[].
+	size_t used;
+	char data[];
+} arenablk;
+
+typedef struct arena {	/* bump allocator, see arena_new(). */
+	arenablk *head;	// first block, blocks are kept over a reset.
+	arenablk *cur;	// block being allocated from.
+	size_t blksize;
+} arena;
+
+typedef struct strlist {	/* packed list of C strings, see strlist_split(). */
+	size_t count;
+	size_t *offs;	// where each string starts in data.
+	char *data;	// the strings, in the same block or in an mdata.
+} strlist;
+
+typedef struct pair {	/* a find/replace or key/value couple. */
+	const char *key;
+	const char *val;
+} pair;
+
+typedef struct cfgstore {	/* a parsed config file, see cfg_parse(). */
+	pair *slots;	// open addressing hash table, key NULL if empty.
+	size_t nslots;	// always a power of 2.
+	size_t count;
+	char *text;	// holds every key and val string.
+} cfgstore;
+
+typedef struct acmach {	/* Aho-Corasick automaton, see ac_compile(). */
+	const pair *tbl;	// the patterns (key) and replacements (val).
+	size_t n;
+	size_t nstates;
+	int *go;	// nstates * 256 state transitions.
+	int *out;	// longest pattern ending at each state, or -1.
+	size_t *depth;	// length of the string spelled by each state.
+	size_t *klen;	// length of each pattern.
+	int grows;	// non-zero if any val is longer than its key.
+} acmach;
+
+typedef struct tmplspan {	/* one piece of a parsed template. */
+	size_t off;	// offset into the template text.
+	size_t len;
+	int slot;	// non-zero if the span is a <placeholder>.
+} tmplspan;
+
+typedef struct strbld {	/* growable C string, see strbld_new(). */
+	char *buf;	// always '\0' terminated.
+	size_t len;	// strlen(buf), kept up to date.
+	size_t cap;	// bytes allocated at buf.
+} strbld;
+
+typedef struct tmpl {	/* a template parsed into spans, see tmpl_compile(). */
+	mdata *md;	// the template text, owned by the tmpl.
+	tmplspan *spans;
+	size_t nspans;
+} tmpl;
+
 int
 printstrlist(char **list);
 
@@ -65,6 +134,9 @@ free_mdata(mdata *);
 void
 *xmalloc(size_t n);
 
+void
+*xcalloc(size_t n, size_t size);
+
 void
 meminsert(const char *line, mdata *md, size_t meminc);
 
@@ -74,6 +146,9 @@ memreplace(mdata *md, char *find , char *repl, off_t meminc);
 void
 memresize(mdata *md, off_t meminc);
 
+void
+mdata_reserve(mdata *md, size_t n);
+
 int
 memlinestostr(mdata *md);
 
@@ -81,20 +156,26 @@ size_t
 memstrtolines(mdata *md);
 
 void
-strjoin(char *buf, char sep, char *tojoin, size_t bufsize);
+strjoin(char *buf, char sep, const char *tojoin, size_t bufsize);
 
 char
-*xstrdup(char *s);
+*xstrdup(const char *s);
 
 char
 *getcfgdata(mdata *md, char *configid);
 
+char
+*getcfgdata_r(mdata *md, const char *configid, char *buf, size_t size);
+
 void
 vfree(void *, ...);
 
 char
 **list2array(char *items, char *sep);
 
+char
+**list2array_a(arena *ap, const char *items, const char *sep);
+
 void
 trimspace(char *buf);
 
@@ -116,18 +197,34 @@ memdel(mdata *md, const char *tofind);
 void
 stripcomment(mdata *md, const char *opn, const char *cls, int lop);
 
+#define SC_BLOCK	1	// stripccomments() flags, see str.c
+#define SC_LINE	2
+#define SC_STRINGS	4
+
+void
+stripccomments(mdata *md, int flags);
+
 char
 **loadconfigs(const char *prgname);
 
+strlist
+*loadconfigs_sl(const char *prgname);
+
 size_t
 countchar(mdata *md, const char ch);
 
 char
 **findconfigs(mdata *md, char ** cfglist, size_t nrconfigs);
 
+char
+**findconfigs_a(arena *ap, mdata *md, char ** cfglist, size_t nrconfigs);
+
 char
 **mdatatostringlist(mdata *md);
 
+char
+**mdatatostringlist_a(arena *ap, mdata *md);
+
 mdata
 *append_eol(mdata *md);
 
@@ -135,6 +232,108 @@ char
 *getconfig(char **configs, char *cfgname);
 
 char
-*dictionary(char **list, char *key);
+*getconfig_r(char **configs, const char *cfgname, char *buf,
+              size_t size);
+
+char
+*getconfig_sl(strlist *configs, const char *cfgname, char *buf,
+              size_t size);
+
+char
+*dictionary(char **list, const char *key);
+
+arena
+*arena_new(size_t blksize);
+
+void
+*arena_alloc(arena *ap, size_t n);
+
+char
+*arena_strdup(arena *ap, const char *s);
+
+char
+*arena_strndup(arena *ap, const char *s, size_t n);
+
+void
+arena_reset(arena *ap);
+
+void
+arena_free(arena *ap);
+
+strlist
+*strlist_split(const char *items, const char *sep);
+
+strlist
+*strlist_lines(mdata *md);
+
+char
+*strlist_item(strlist *sl, size_t i);
+
+cfgstore
+*cfg_parse(mdata *md);
+
+const char
+*cfg_get(cfgstore *cs, const char *key);
+
+void
+free_cfgstore(cfgstore *cs);
+
+tmpl
+*tmpl_compile(mdata *md);
+
+mdata
+*tmpl_render(tmpl *tp, const pair *tbl, size_t n);
+
+struct iovec
+*tmpl_iov(tmpl *tp, const pair *tbl, size_t n, size_t *count);
+
+void
+free_tmpl(tmpl *tp);
+
+acmach
+*ac_compile(const pair *tbl, size_t n);
+
+void
+free_acmach(acmach *ac);
+
+char
+*ac_next(acmach *ac, char *fro, char *to, size_t *which);
+
+size_t
+ac_replace(acmach *ac, mdata *md);
+
+size_t
+memreplace_multi(mdata *md, const pair *tbl, size_t n);
+
+strbld
+*strbld_new(size_t hint);
+
+void
+strbld_reserve(strbld *sb, size_t n);
+
+void
+strbld_appendn(strbld *sb, const char *s, size_t n);
+
+void
+strbld_append(strbld *sb, const char *s);
+
+void
+strbld_printf(strbld *sb, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+void
+strbld_join(strbld *sb, char sep, const char *s);
+
+void
+strbld_reset(strbld *sb);
+
+void
+strbld_truncate(strbld *sb, size_t len);
+
+char
+*strbld_detach(strbld *sb);
+
+void
+free_strbld(strbld *sb);
 
 #endif